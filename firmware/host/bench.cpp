@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+// Microbenchmarks of the firmware's hot paths, built for the host. The
+// numbers only compare against each other and against earlier runs on the
+// same machine, the RP2040 is a lot slower, see the CLI 'd' command for the
+// real decoder cost.
+
+#include <sctu/controller.h>
+#include <sctu/decoder.h>
+#include <sctu/filter.h>
+#include <sctu/latency.h>
+#include <sctu/report.h>
+#include <sctu/syslog.h>
+#include <sctu/usb.h>
+
+#include <mock_usb.h>
+#include <tusb.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+
+// Keeps results alive, so the compiler can't drop the work
+static volatile uint32_t sink;
+
+// Runs the function for the given number of iterations, passing the
+// iteration number, and prints the average time per iteration
+template<typename F>
+static void benchmark(const char *name, unsigned iterations, F&& function)
+{
+	using clock = std::chrono::steady_clock;
+	// Warm up caches and branch predictors first
+	for (unsigned i = 0; i < iterations / 16; ++i)
+		function(i);
+
+	const clock::time_point start = clock::now();
+	for (unsigned i = 0; i < iterations; ++i)
+		function(i);
+	const std::chrono::duration<double, std::nano> elapsed =
+		clock::now() - start;
+	printf("%-28s %10.2f ns/op\n", name, elapsed.count() / iterations);
+}
+
+// Raw words that change every iteration, so nothing can be hoisted
+static uint32_t word(unsigned i)
+{
+	return i * 0x9E3779B9u ^ 0xFF00FF00u;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned iterations = 1000000;
+	if (argc > 1)
+		iterations = std::max(1ul, strtoul(argv[1], nullptr, 10));
+
+	benchmark("decode (table)", iterations, [](unsigned i)
+	{
+		sink = sink + sctu::decode(word(i)).buttons;
+	});
+
+	benchmark("decode (reference)", iterations, [](unsigned i)
+	{
+		sink = sink + sctu::decode_reference(word(i)).buttons;
+	});
+
+	benchmark("deinterleave", iterations, [](unsigned i)
+	{
+		sink = sink + sctu::deinterleave(word(i)).data1;
+	});
+
+	benchmark("decode all ports", iterations, [](unsigned i)
+	{
+		std::array<uint32_t, sctu::port_count> raw;
+		for (size_t port = 0; port < raw.size(); ++port)
+			raw[port] = word(i + port);
+		for (const auto& state: sctu::decode(raw))
+			sink = sink + state.buttons;
+	});
+
+	for (unsigned window: {3u, 5u, 7u})
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "majority of %u", window);
+		benchmark(name, iterations, [window](unsigned i)
+		{
+			std::array<uint32_t, sctu::max_filter_samples> samples;
+			for (size_t n = 0; n < window; ++n)
+				samples[n] = word(i + n);
+			sink = sink + sctu::majority(std::span(samples.data(), window));
+		});
+	}
+
+	static sctu::sample_filter filter;
+	filter.set_window(5);
+	benchmark("sample filter, window 5", iterations, [](unsigned i)
+	{
+		sctu::sample_filter::sample raw;
+		for (size_t port = 0; port < raw.size(); ++port)
+			raw[port] = word(i + port);
+		filter.apply(raw);
+		sink = sink + raw[0];
+	});
+
+	benchmark("make report", iterations, [](unsigned i)
+	{
+		sink = sink + sctu::make_report(sctu::decode(word(i)))[2];
+	});
+
+	// Same size as the firmware's log, see log.h
+	static sctu::syslog<1024*8> log;
+	benchmark("log push (text)", iterations, [](unsigned)
+	{
+		log.push("pio_controllers: sample timed out");
+	});
+
+	benchmark("log push (binary)", iterations, [](unsigned i)
+	{
+		log.log(sctu::log_level::info, "port %u data%u: %s",
+			i & 7u, i & 1u, "gamepad");
+	});
+
+	benchmark("log push + read (binary)", iterations, [](unsigned i)
+	{
+		// Keep the log full, so every read formats a record
+		log.log(sctu::log_level::info, "port %u data%u: %s",
+			i & 7u, i & 1u, "gamepad");
+		std::array<char, decltype(log)::max_record_size> buffer;
+		auto cursor = log.begin();
+		if (auto entry = log.read(cursor, buffer))
+			sink = sink + entry->text.size();
+	});
+
+	static sctu::latency_histogram histogram;
+	benchmark("latency histogram record", iterations, [](unsigned i)
+	{
+		histogram.record(word(i) & 0xFFF);
+	});
+
+	// What enumeration costs the USB task, the configuration descriptors
+	// themselves are built at compile time
+	benchmark("prepare descriptors", iterations, [](unsigned)
+	{
+		usb_prepare_descriptors();
+	});
+
+	const struct
+	{
+		const char *name;
+		sctu::hid_layout layout;
+	} layouts[] = {
+		{ "config descriptor (dynamic)", sctu::hid_layout::dynamic },
+		{ "config descriptor (fixed)", sctu::hid_layout::fixed },
+		{ "config descriptor (combined)", sctu::hid_layout::combined },
+	};
+	for (const auto& layout: layouts)
+	{
+		benchmark(layout.name, iterations, [&layout](unsigned i)
+		{
+			sctu::mock::set_usb_state(layout.layout,
+				sctu::report_intervals_ms[i % sctu::report_intervals_ms.size()],
+				static_cast<uint8_t>(i));
+			sink = sink + tud_descriptor_configuration_cb(0)[2];
+		});
+	}
+
+	sctu::mock::set_usb_state(sctu::hid_layout::dynamic, 1, 0xFF);
+	benchmark("string descriptor", iterations, [](unsigned i)
+	{
+		sink = sink + tud_descriptor_string_cb(
+			static_cast<uint8_t>(i % 14), 0x0409)[0];
+	});
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+// Checks the table driven decoder against the bit by bit reference. Every
+// DATA0 stream is tried against a few DATA1 patterns, as decode() must ignore
+// DATA1, and then a stride through every other word.
+
+#include <sctu/controller.h>
+#include <sctu/decoder.h>
+
+#include <cstdint>
+#include <cstdio>
+
+static unsigned failures = 0;
+
+static void check(uint32_t word)
+{
+	const sctu::controller fast = sctu::decode(word);
+	const sctu::controller reference = sctu::decode_reference(word);
+	if (fast == reference)
+		return;
+
+	// Don't flood the output if a table is wrong
+	if (++failures <= 10)
+	{
+		printf("%08X: decode %d %d %d %02X, reference %d %d %d %02X\n", word,
+			fast.connected, fast.x, fast.y, fast.buttons,
+			reference.connected, reference.x, reference.y, reference.buttons);
+	}
+}
+
+// Spreads a stream over the even bits of a word
+static uint32_t spread(uint16_t stream)
+{
+	uint32_t word = 0;
+	for (unsigned bit = 0; bit < 16; ++bit)
+		word |= ((stream >> bit) & 1u) << (2 * bit);
+	return word;
+}
+
+int main()
+{
+	uint32_t words = 0;
+	for (uint32_t data0 = 0; data0 <= 0xFFFF; ++data0)
+	{
+		for (const uint16_t data1: { 0x0000, 0xFFFF, 0x5555, 0xAAAA })
+		{
+			check(spread(data0) | spread(data1) << 1);
+			++words;
+		}
+	}
+
+	// An odd stride, so every bit gets to be both set and clear
+	for (uint64_t word = 0; word <= 0xFFFFFFFF; word += 4099)
+	{
+		check(static_cast<uint32_t>(word));
+		++words;
+	}
+
+	printf("%lu words, %u mismatches\n",
+		static_cast<unsigned long>(words), failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_FREERTOS_H_
+#define SCTU_MOCK_FREERTOS_H_
+
+#include <cstdint>
+
+// Host stand-in for the FreeRTOS types the firmware headers mention. Nothing
+// built for the host creates tasks or waits on anything.
+
+typedef uint32_t TickType_t;
+
+#endif//SCTU_MOCK_FREERTOS_H_
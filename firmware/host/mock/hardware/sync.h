@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_HARDWARE_SYNC_H_
+#define SCTU_MOCK_HARDWARE_SYNC_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Host stand-ins for the RP2040 hardware spinlocks, backed by atomic flags so
+// they still exclude other threads. There are no interrupts to disable, so the
+// saved state is always 0.
+
+typedef std::atomic_flag spin_lock_t;
+
+int spin_lock_claim_unused(bool required);
+
+spin_lock_t *spin_lock_init(unsigned lock_num);
+
+inline uint32_t spin_lock_blocking(spin_lock_t *lock)
+{
+	while (lock->test_and_set(std::memory_order_acquire))
+		;
+	return 0;
+}
+
+inline void spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+	(void) saved_irq;
+	lock->clear(std::memory_order_release);
+}
+
+inline uint32_t save_and_disable_interrupts()
+{
+	return 0;
+}
+
+inline void restore_interrupts(uint32_t status)
+{
+	(void) status;
+}
+
+#endif//SCTU_MOCK_HARDWARE_SYNC_H_
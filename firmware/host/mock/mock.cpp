@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <hardware/sync.h>
+#include <pico/platform.h>
+#include <pico/time.h>
+#include <pico/unique_id.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// The RP2040 has 32 hardware spinlocks
+static std::array<spin_lock_t, 32> spin_locks;
+static std::atomic<unsigned> spin_locks_claimed = 0;
+
+int spin_lock_claim_unused(bool required)
+{
+	const unsigned lock = spin_locks_claimed++;
+	if (lock >= spin_locks.size())
+	{
+		if (required)
+			panic("No spinlocks are available");
+		return -1;
+	}
+	return static_cast<int>(lock);
+}
+
+spin_lock_t *spin_lock_init(unsigned lock_num)
+{
+	spin_lock_t *lock = &spin_locks[lock_num];
+	lock->clear();
+	return lock;
+}
+
+void panic(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	fputs("panic: ", stderr);
+	vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+	va_end(args);
+	abort();
+}
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out)
+{
+	static constexpr const std::array<uint8_t, PICO_UNIQUE_BOARD_ID_SIZE_BYTES> id
+		{ 0xE6, 0x61, 0x38, 0x52, 0x83, 0x57, 0x5A, 0x2C };
+	std::copy(id.begin(), id.end(), id_out->id);
+}
+
+static std::atomic<int64_t> fixed_time_us = -1;
+
+uint64_t time_us_64()
+{
+	const int64_t fixed = fixed_time_us;
+	if (fixed >= 0)
+		return static_cast<uint64_t>(fixed);
+
+	using clock = std::chrono::steady_clock;
+	static const clock::time_point start = clock::now();
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(
+			clock::now() - start).count());
+}
+
+namespace sctu::mock
+{
+	void set_time_us(int64_t us)
+	{
+		fixed_time_us = us;
+	}
+}
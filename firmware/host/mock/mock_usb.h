@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_MOCK_USB_H_
+#define SCTU_MOCK_MOCK_USB_H_
+
+#include <sctu/settings.h>
+
+#include <cstdint>
+
+// Host stand-ins for the USB task state the descriptor callbacks read, see
+// usb.h. There's no USB task on the host, whatever was set last is what the
+// host enumerated.
+
+namespace sctu::mock
+{
+	/** Sets what the descriptor callbacks describe.
+	 *
+	 * @param[in] layout HID interface layout.
+	 * @param[in] interval_ms Endpoint polling interval in ms.
+	 * @param[in] controllers Bitmask of enumerated controllers.
+	 */
+	void set_usb_state(hid_layout layout, uint8_t interval_ms,
+		uint8_t controllers);
+}
+
+#endif//SCTU_MOCK_MOCK_USB_H_
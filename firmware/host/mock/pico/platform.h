@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_PICO_PLATFORM_H_
+#define SCTU_MOCK_PICO_PLATFORM_H_
+
+// Host stand-ins for the pico-sdk platform functions. Code on the host always
+// runs in thread mode, on "core 0".
+
+[[noreturn]] void panic(const char *format, ...);
+
+inline unsigned __get_current_exception()
+{
+	return 0;
+}
+
+inline unsigned get_core_num()
+{
+	return 0;
+}
+
+#endif//SCTU_MOCK_PICO_PLATFORM_H_
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_PICO_TIME_H_
+#define SCTU_MOCK_PICO_TIME_H_
+
+#include <cstdint>
+
+// Host stand-ins for the RP2040 timer, counting us since the first call. The
+// replay tool can also drive it by hand, so its output doesn't depend on how
+// fast the host is.
+
+uint64_t time_us_64();
+
+inline uint32_t time_us_32()
+{
+	return static_cast<uint32_t>(time_us_64());
+}
+
+namespace sctu::mock
+{
+	/** Freezes time_us_64() at the given time, until this is called again.
+	 * A negative time goes back to the host clock. */
+	void set_time_us(int64_t us);
+}
+
+#endif//SCTU_MOCK_PICO_TIME_H_
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_PICO_UNIQUE_ID_H_
+#define SCTU_MOCK_PICO_UNIQUE_ID_H_
+
+#include <cstdint>
+
+// Host stand-in for the flash unique ID, always the same made up ID, so the
+// serial number descriptor doesn't change between runs.
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+typedef struct
+{
+	uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES];
+} pico_unique_board_id_t;
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out);
+
+#endif//SCTU_MOCK_PICO_UNIQUE_ID_H_
@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_TASK_H_
+#define SCTU_MOCK_TASK_H_
+
+#include <FreeRTOS.h>
+
+typedef struct tskTaskControlBlock *TaskHandle_t;
+
+#endif//SCTU_MOCK_TASK_H_
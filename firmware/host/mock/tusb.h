@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_MOCK_TUSB_H_
+#define SCTU_MOCK_TUSB_H_
+
+#include <tusb_config.h>
+
+#include <stdint.h>
+#include <string.h>
+
+// Host stand-in for the parts of TinyUSB the descriptor code uses: the
+// descriptor constants, the macros that lay descriptors out, and the
+// descriptor callbacks. The values and layouts are TinyUSB's, so the host
+// build produces the same bytes the firmware sends.
+
+#define TU_BIT(n)             (1UL << (n))
+#define TU_U16_HIGH(_u16)     ((uint8_t) (((_u16) >> 8) & 0x00ff))
+#define TU_U16_LOW(_u16)      ((uint8_t) ((_u16)       & 0x00ff))
+#define U16_TO_U8S_LE(_u16)   TU_U16_LOW(_u16), TU_U16_HIGH(_u16)
+
+enum
+{
+	TUSB_DESC_DEVICE                = 0x01,
+	TUSB_DESC_CONFIGURATION         = 0x02,
+	TUSB_DESC_STRING                = 0x03,
+	TUSB_DESC_INTERFACE             = 0x04,
+	TUSB_DESC_ENDPOINT              = 0x05,
+	TUSB_DESC_INTERFACE_ASSOCIATION = 0x0B,
+	TUSB_DESC_CS_INTERFACE          = 0x24,
+};
+
+enum
+{
+	TUSB_CLASS_CDC      = 2,
+	TUSB_CLASS_HID      = 3,
+	TUSB_CLASS_CDC_DATA = 10,
+	TUSB_CLASS_MISC     = 0xEF,
+};
+
+enum
+{
+	MISC_SUBCLASS_COMMON = 2,
+	MISC_PROTOCOL_IAD    = 1,
+};
+
+enum
+{
+	TUSB_XFER_BULK      = 2,
+	TUSB_XFER_INTERRUPT = 3,
+};
+
+typedef struct __attribute__((packed))
+{
+	uint8_t  bLength;
+	uint8_t  bDescriptorType;
+	uint16_t bcdUSB;
+	uint8_t  bDeviceClass;
+	uint8_t  bDeviceSubClass;
+	uint8_t  bDeviceProtocol;
+	uint8_t  bMaxPacketSize0;
+	uint16_t idVendor;
+	uint16_t idProduct;
+	uint16_t bcdDevice;
+	uint8_t  iManufacturer;
+	uint8_t  iProduct;
+	uint8_t  iSerialNumber;
+	uint8_t  bNumConfigurations;
+} tusb_desc_device_t;
+
+static_assert(sizeof(tusb_desc_device_t) == 18);
+
+//--------------------------------------------------------------------+
+// CDC
+//--------------------------------------------------------------------+
+
+enum
+{
+	CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL = 2,
+	CDC_COMM_PROTOCOL_NONE                   = 0,
+	CDC_FUNC_DESC_HEADER                     = 0x00,
+	CDC_FUNC_DESC_CALL_MANAGEMENT            = 0x01,
+	CDC_FUNC_DESC_ABSTRACT_CONTROL_MANAGEMENT = 0x02,
+	CDC_FUNC_DESC_UNION                      = 0x06,
+};
+
+#define TUD_CONFIG_DESC_LEN   (9)
+
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma) \
+	9, TUSB_DESC_CONFIGURATION, U16_TO_U8S_LE(_total_len), _itfcount, config_num, _stridx, TU_BIT(7) | _attribute, (_power_ma)/2
+
+#define TUD_CDC_DESC_LEN  (8+9+5+5+4+5+7+9+7+7)
+
+#define TUD_CDC_DESCRIPTOR(_itfnum, _stridx, _ep_notif, _ep_notif_size, _epout, _epin, _epsize) \
+	/* Interface Associate */\
+	8, TUSB_DESC_INTERFACE_ASSOCIATION, _itfnum, 2, TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL, CDC_COMM_PROTOCOL_NONE, 0,\
+	/* CDC Control Interface */\
+	9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL, CDC_COMM_PROTOCOL_NONE, _stridx,\
+	/* CDC Header */\
+	5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_HEADER, U16_TO_U8S_LE(0x0120),\
+	/* CDC Call */\
+	5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_CALL_MANAGEMENT, 0, (uint8_t)((_itfnum) + 1),\
+	/* CDC ACM: support line request + send break */\
+	4, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_ABSTRACT_CONTROL_MANAGEMENT, 6,\
+	/* CDC Union */\
+	5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_UNION, _itfnum, (uint8_t)((_itfnum) + 1),\
+	/* Endpoint Notification */\
+	7, TUSB_DESC_ENDPOINT, _ep_notif, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_ep_notif_size), 16,\
+	/* CDC Data Interface */\
+	9, TUSB_DESC_INTERFACE, (uint8_t)((_itfnum)+1), 0, 2, TUSB_CLASS_CDC_DATA, 0, 0, 0,\
+	/* Endpoint Out */\
+	7, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+	/* Endpoint In */\
+	7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0
+
+//--------------------------------------------------------------------+
+// HID
+//--------------------------------------------------------------------+
+
+enum
+{
+	HID_SUBCLASS_BOOT     = 1,
+	HID_ITF_PROTOCOL_NONE = 0,
+	HID_DESC_TYPE_HID     = 0x21,
+	HID_DESC_TYPE_REPORT  = 0x22,
+};
+
+#define TUD_HID_DESC_LEN    (9 + 9 + 7)
+
+#define TUD_HID_DESCRIPTOR(_itfnum, _stridx, _boot_protocol, _report_desc_len, _epin, _epsize, _ep_interval) \
+	/* Interface */\
+	9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_HID, (uint8_t)((_boot_protocol) ? (uint8_t)HID_SUBCLASS_BOOT : 0), _boot_protocol, _stridx,\
+	/* HID descriptor */\
+	9, HID_DESC_TYPE_HID, U16_TO_U8S_LE(0x0111), 0, 1, HID_DESC_TYPE_REPORT, U16_TO_U8S_LE(_report_desc_len),\
+	/* Endpoint In */\
+	7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_epsize), _ep_interval
+
+// Report descriptor items
+#define HID_REPORT_DATA_0(data)
+#define HID_REPORT_DATA_1(data) , data
+#define HID_REPORT_DATA_2(data) , U16_TO_U8S_LE(data)
+
+#define HID_REPORT_ITEM(data, tag, type, size) \
+	(((tag) << 4) | ((type) << 2) | (size)) HID_REPORT_DATA_##size(data)
+
+#define RI_TYPE_MAIN   0
+#define RI_TYPE_GLOBAL 1
+#define RI_TYPE_LOCAL  2
+
+#define RI_MAIN_INPUT          8
+#define RI_MAIN_COLLECTION     10
+#define RI_MAIN_COLLECTION_END 12
+
+#define RI_GLOBAL_USAGE_PAGE   0
+#define RI_GLOBAL_LOGICAL_MIN  1
+#define RI_GLOBAL_LOGICAL_MAX  2
+#define RI_GLOBAL_REPORT_SIZE  7
+#define RI_GLOBAL_REPORT_ID    8
+#define RI_GLOBAL_REPORT_COUNT 9
+
+#define RI_LOCAL_USAGE     0
+#define RI_LOCAL_USAGE_MIN 1
+#define RI_LOCAL_USAGE_MAX 2
+
+#define HID_INPUT(x)        HID_REPORT_ITEM(x, RI_MAIN_INPUT, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION(x)   HID_REPORT_ITEM(x, RI_MAIN_COLLECTION, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION_END  HID_REPORT_ITEM(x, RI_MAIN_COLLECTION_END, RI_TYPE_MAIN, 0)
+
+#define HID_USAGE_PAGE(x)   HID_REPORT_ITEM(x, RI_GLOBAL_USAGE_PAGE, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MIN(x)  HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MIN, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MAX(x)  HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MAX, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_SIZE(x)  HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_SIZE, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_ID(x)    HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_ID, RI_TYPE_GLOBAL, 1),
+#define HID_REPORT_COUNT(x) HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_COUNT, RI_TYPE_GLOBAL, 1)
+
+#define HID_USAGE(x)        HID_REPORT_ITEM(x, RI_LOCAL_USAGE, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MIN(x)    HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MIN, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MAX(x)    HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MAX, RI_TYPE_LOCAL, 1)
+
+enum
+{
+	HID_DATA     = 0,
+	HID_VARIABLE = TU_BIT(1),
+	HID_ABSOLUTE = 0,
+};
+
+enum
+{
+	HID_COLLECTION_APPLICATION = 1,
+};
+
+enum
+{
+	HID_USAGE_PAGE_DESKTOP = 0x01,
+	HID_USAGE_PAGE_BUTTON  = 0x09,
+};
+
+enum
+{
+	HID_USAGE_DESKTOP_GAMEPAD = 0x05,
+	HID_USAGE_DESKTOP_X       = 0x30,
+	HID_USAGE_DESKTOP_Y       = 0x31,
+};
+
+//--------------------------------------------------------------------+
+// Descriptor callbacks, defined by the application
+//--------------------------------------------------------------------+
+
+extern "C"
+{
+	const uint8_t* tud_descriptor_device_cb(void);
+	const uint8_t* tud_descriptor_configuration_cb(uint8_t index);
+	const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+	const uint8_t* tud_hid_descriptor_report_cb(uint8_t itf);
+}
+
+#endif//SCTU_MOCK_TUSB_H_
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <mock_usb.h>
+
+#include <sctu/usb.h>
+
+#include <tusb.h>
+
+#include <cstdint>
+
+static sctu::hid_layout current_layout = sctu::hid_layout::dynamic;
+static uint8_t current_interval_ms = sctu::report_intervals_ms.front();
+static uint8_t current_controllers = 0;
+
+sctu::hid_layout usb_get_layout()
+{
+	return current_layout;
+}
+
+uint8_t usb_get_report_interval()
+{
+	return current_interval_ms;
+}
+
+uint8_t usb_get_enumerated_controllers()
+{
+	return current_controllers;
+}
+
+// Same mapping as the firmware's, see usb.cpp
+int usb_hid_controller(uint8_t instance)
+{
+	if (instance >= CFG_TUD_HID)
+		return -1;
+	if (current_layout == sctu::hid_layout::fixed)
+		return instance;
+	if (current_layout == sctu::hid_layout::combined)
+		return -1;
+
+	uint8_t enumerated = current_controllers;
+	for (uint8_t controller = 0; enumerated; ++controller, enumerated >>= 1)
+	{
+		if ((enumerated & 1) && instance-- == 0)
+			return controller;
+	}
+	return -1;
+}
+
+namespace sctu::mock
+{
+	void set_usb_state(hid_layout layout, uint8_t interval_ms,
+		uint8_t controllers)
+	{
+		current_layout = layout;
+		current_interval_ms = interval_ms;
+		current_controllers = controllers;
+	}
+}
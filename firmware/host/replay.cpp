@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+// Feeds recorded raw PIO words through the same filter, decoder and report
+// code as the firmware, and prints every report change. The output only
+// depends on the input, so it can be diffed against a known good run. The
+// time it took goes to stderr.
+//
+// Input is text, one sample per line: SCTU_PORT_COUNT hex words, the word of
+// every port as the DMA chain collects it. Empty lines and anything after a
+// '#' are ignored. It can also be what the firmware sends in capture mode,
+// frames of capture records, see capture_frame.h. Anything between frames,
+// like the CLI's answers, is skipped.
+//
+// usage: sctu_replay [-f window] [file]
+
+#include <sctu/capture_frame.h>
+#include <sctu/controller.h>
+#include <sctu/decoder.h>
+#include <sctu/filter.h>
+#include <sctu/report.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <vector>
+
+using sample = sctu::sample_filter::sample;
+
+// Parses one line of input, returns false if it holds no sample
+static bool parse(char *line, size_t number, sample& result)
+{
+	if (char *comment = strchr(line, '#'))
+		*comment = '\0';
+
+	char *position = line;
+	size_t words = 0;
+	for (;;)
+	{
+		char *end;
+		const unsigned long value = strtoul(position, &end, 16);
+		if (end == position)
+			break;
+		if (words < result.size())
+			result[words] = static_cast<uint32_t>(value);
+		++words;
+		position = end;
+	}
+
+	if (!words)
+		return false;
+	if (words != result.size())
+	{
+		fprintf(stderr, "line %zu: expected %zu words, got %zu\n",
+			number, result.size(), words);
+		exit(1);
+	}
+	return true;
+}
+
+// Returns whether a frame header this firmware could have sent starts at
+// data
+static bool is_frame(std::span<const uint8_t> data)
+{
+	sctu::capture_frame header;
+	if (data.size() < sizeof(header))
+		return false;
+	memcpy(&header, data.data(), sizeof(header));
+	return header.sync == sctu::capture_sync &&
+		header.ports == sctu::port_count &&
+		header.count <= sctu::max_frame_records;
+}
+
+// Reads capture frames until the end of the input or a frame with no
+// records, skipping anything that isn't a frame. Returns the samples lost by
+// the firmware.
+static size_t read_frames(std::span<const uint8_t> data,
+	std::vector<sample>& samples)
+{
+	size_t dropped = 0;
+	size_t skipped = 0;
+	while (!data.empty())
+	{
+		if (!is_frame(data))
+		{
+			data = data.subspan(1);
+			++skipped;
+			continue;
+		}
+
+		sctu::capture_frame header;
+		memcpy(&header, data.data(), sizeof(header));
+		if (!header.count)
+			break;
+		const size_t size =
+			sizeof(header) + header.count * sizeof(sctu::capture_record);
+		if (data.size() < size)
+		{
+			fprintf(stderr, "last frame truncated\n");
+			break;
+		}
+
+		dropped += header.dropped;
+		for (size_t i = 0; i < header.count; ++i)
+		{
+			sctu::capture_record record;
+			memcpy(&record,
+				data.data() + sizeof(header) + i * sizeof(record),
+				sizeof(record));
+			samples.push_back(record.raw);
+		}
+		data = data.subspan(size);
+	}
+
+	if (skipped)
+		printf("capture skipped %zu bytes between frames\n", skipped);
+	return dropped;
+}
+
+// Reads text samples, one per line
+static void read_lines(std::span<char> data, std::vector<sample>& samples)
+{
+	size_t number = 1;
+	while (!data.empty())
+	{
+		char *line = data.data();
+		char *newline = static_cast<char*>(memchr(line, '\n', data.size()));
+		const size_t length = newline ? newline - line + 1 : data.size();
+		// The buffer has a spare '\0' past its end for the last line
+		line[newline ? length - 1 : length] = '\0';
+		sample raw;
+		if (parse(line, number++, raw))
+			samples.push_back(raw);
+		data = data.subspan(length);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned window = 1;
+	const char *path = nullptr;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			window = strtoul(argv[++i], nullptr, 10);
+		else
+			path = argv[i];
+	}
+
+	FILE *input = path ? fopen(path, "rb") : stdin;
+	if (!input)
+	{
+		perror(path);
+		return 1;
+	}
+
+	std::vector<char> data;
+	std::array<char, 4096> chunk;
+	while (const size_t read = fread(chunk.data(), 1, chunk.size(), input))
+		data.insert(data.end(), chunk.begin(), chunk.begin() + read);
+	if (input != stdin)
+		fclose(input);
+	const size_t size = data.size();
+	data.push_back('\0');
+
+	// Text is plain ASCII, so any frame header at all makes it a capture,
+	// even with the CLI's answers in front of it
+	std::vector<sample> samples;
+	const std::span<const uint8_t> bytes(
+		reinterpret_cast<const uint8_t*>(data.data()), size);
+	bool capture = false;
+	for (size_t i = 0; i < size && !capture; ++i)
+		capture = is_frame(bytes.subspan(i));
+	if (capture)
+	{
+		if (const size_t dropped = read_frames(bytes, samples))
+			printf("capture dropped %zu samples\n", dropped);
+	}
+	else
+	{
+		read_lines(std::span(data).first(size), samples);
+	}
+
+	sctu::sample_filter filter;
+	filter.set_window(window);
+	std::array<sctu::hid_report, sctu::max_players> reported = {};
+	std::array<bool, sctu::max_players> connected = {};
+	size_t changes = 0;
+
+	using clock = std::chrono::steady_clock;
+	clock::duration elapsed = {};
+	for (size_t n = 0; n < samples.size(); ++n)
+	{
+		// Only time the pipeline itself, not the printing
+		const clock::time_point start = clock::now();
+		sample raw = samples[n];
+		filter.apply(raw);
+		const auto state = sctu::decode(raw);
+		std::array<sctu::hid_report, sctu::max_players> reports;
+		for (size_t player = 0; player < state.size(); ++player)
+			reports[player] = sctu::make_report(state[player]);
+		elapsed += clock::now() - start;
+
+		for (size_t player = 0; player < state.size(); ++player)
+		{
+			if (state[player].connected != connected[player])
+			{
+				connected[player] = state[player].connected;
+				printf("%zu: player %zu %s\n", n, player + 1,
+					connected[player] ? "connected" : "disconnected");
+			}
+			if (reports[player] != reported[player])
+			{
+				reported[player] = reports[player];
+				printf("%zu: player %zu report %02X %02X %02X\n", n, player + 1,
+					reports[player][0], reports[player][1], reports[player][2]);
+				++changes;
+			}
+		}
+	}
+
+	printf("%zu samples, %zu report changes\n", samples.size(), changes);
+	const std::chrono::duration<double, std::nano> total = elapsed;
+	fprintf(stderr, "%.2f ns/sample\n",
+		samples.empty() ? 0.0 : total.count() / samples.size());
+	return 0;
+}
@@ -0,0 +1,20 @@
+# Runs sctu_replay on INPUT and fails unless what it prints matches EXPECTED.
+# The timing on stderr is left out, it changes every run.
+
+execute_process(
+	COMMAND ${REPLAY} -f 3 ${INPUT}
+	OUTPUT_FILE ${OUTPUT}
+	ERROR_QUIET
+	RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "sctu_replay failed: ${result}")
+endif()
+
+execute_process(
+	COMMAND ${CMAKE_COMMAND} -E compare_files --ignore-eol ${OUTPUT} ${EXPECTED}
+	RESULT_VARIABLE different
+)
+if(different)
+	message(FATAL_ERROR "${OUTPUT} doesn't match ${EXPECTED}")
+endif()
@@ -7,9 +7,11 @@
 
 // Scheduler related options
 #define configUSE_PREEMPTION                    1
+// The SMP port can't suppress ticks, so idle cores sleep between them in the
+// idle hooks instead, see FreeRTOS_support.cpp
 #define configUSE_TICKLESS_IDLE                 0
-#define configUSE_IDLE_HOOK                     0
-#define configUSE_PASSIVE_IDLE_HOOK             0
+#define configUSE_IDLE_HOOK                     1
+#define configUSE_PASSIVE_IDLE_HOOK             1
 #define configUSE_TICK_HOOK                     0
 #define configTICK_RATE_HZ                      ( ( TickType_t ) 1000 )
 #define configMAX_PRIORITIES                    32
@@ -37,20 +39,45 @@
 
 // Memory allocation related definitions
 #define configSUPPORT_STATIC_ALLOCATION         1
+#ifdef SCTU_STATIC_ALLOCATION
+// No heap at all, every kernel object must be created statically
+#define configSUPPORT_DYNAMIC_ALLOCATION        0
+#else
 #define configSUPPORT_DYNAMIC_ALLOCATION        1
-#define configTOTAL_HEAP_SIZE                   (16*1024)
+#endif
+// Task stacks are all static, so the heap is only a fallback
+#define configTOTAL_HEAP_SIZE                   (4*1024)
 #define configAPPLICATION_ALLOCATED_HEAP        0
 
 // Hook function related definitions
 #define configCHECK_FOR_STACK_OVERFLOW          2
-#define configUSE_MALLOC_FAILED_HOOK            0
+#define configUSE_MALLOC_FAILED_HOOK            1
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
 // Run time and task stats gathering related definitions
-#define configGENERATE_RUN_TIME_STATS           0
+// Run time is counted in us, from the free-running 1 MHz timer, so the
+// counters only wrap after half a million years. See sctu/run_time_stats.h.
+#define configGENERATE_RUN_TIME_STATS           1
+#define configRUN_TIME_COUNTER_TYPE             uint64_t
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    0
 
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint64_t time_us_64(void);
+void sctu_task_switched_in(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+// The timer is already running by the time the scheduler starts
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()        time_us_64()
+
 // Co-routine related definitions
 #define configUSE_CO_ROUTINES                   0
 #define configMAX_CO_ROUTINE_PRIORITIES         1
@@ -104,5 +131,6 @@ to exclude the API function. */
 #define INCLUDE_uxTaskGetStackHighWaterMark     1
 
 /* A header file that defines trace macro can be included here. */
+#define traceTASK_SWITCHED_IN()                 sctu_task_switched_in()
 
 #endif//FREERTOSCONFIG_H_
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_ALLOCATION_H_
+#define SCTU_ALLOCATION_H_
+
+namespace sctu
+{
+	/** Marks the end of initialization, nothing should allocate after this.
+	 *
+	 * In builds with SCTU_STATIC_ALLOCATION, any C++ allocation after this
+	 * panics, so a stray container or std::function in a run time path shows
+	 * up right away instead of as heap exhaustion in the field. FreeRTOS has
+	 * no heap at all in those builds, so creating a kernel object
+	 * dynamically doesn't even link.
+	 */
+	void seal_allocations();
+
+	/** Returns whether seal_allocations() was called. */
+	bool allocations_sealed();
+}
+
+#endif//SCTU_ALLOCATION_H_
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_BOARD_H_
+#define SCTU_BOARD_H_
+
+#include <sctu/controller.h>
+#include <sctu/pio_controllers.h>
+
+#include <algorithm>
+#include <array>
+
+namespace sctu
+{
+#if SCTU_PORT_COUNT <= 4
+	// Every port has its DATA0, DATA1, and IOBIT pins next to each other
+	constexpr const std::array<uint, 4> board_data_pins { 2, 5, 8, 11 };
+	/// Port LED pins.
+	constexpr const std::array<int, 4> led_gpios { 14, 15, 16, 17 };
+	/// Pin driven by the loopback tester, see loopback.h.
+	constexpr const int loopback_pin = 22;
+#else
+	// There aren't enough free pins for more ports with IOBIT, nor for an LED
+	// per port, so ports 5 to 8 only get DATA0 and DATA1, and take over the
+	// LED pins
+	constexpr const std::array<uint, 8> board_data_pins {
+		2, 5, 8, 11, 14, 16, 18, 20 };
+	/// Port LED pins, each is shared by ports N and N + 4.
+	constexpr const std::array<int, 4> led_gpios { 22, 26, 27, 28 };
+	/// Pin driven by the loopback tester, see loopback.h. With all 8 ports
+	/// there's no pin left for it.
+	constexpr const int loopback_pin = SCTU_PORT_COUNT < 8 ? 21 : -1;
+#endif
+
+	/// Pins used by the controller hub on this board.
+	constexpr const pin_map board_pins = []
+	{
+		pin_map pins = { .clk = 0, .latch = 1, .data = {} };
+		std::copy_n(board_data_pins.begin(), port_count, pins.data.begin());
+		return pins;
+	}();
+}
+
+#endif//SCTU_BOARD_H_
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_BOOT_TIME_H_
+#define SCTU_BOOT_TIME_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace sctu
+{
+	/** Milestones of a boot, in the order they normally happen. */
+	enum class boot_stage : uint8_t
+	{
+		/// The scheduler ran the init task, after the boot ROM, the runtime
+		/// and static constructors.
+		init_task,
+		/// Both cores have their MPU set up.
+		mpu_ready,
+		/// Settings were read from flash.
+		settings_loaded,
+		/// The controllers were sampled once, before USB started.
+		controllers_probed,
+		/// TinyUSB is up and the device is on the bus.
+		usb_started,
+		/// The host asked for the device descriptor.
+		host_request,
+		/// The host set a configuration.
+		mounted,
+		/// The first HID report was queued.
+		first_report,
+	};
+
+	constexpr const size_t boot_stage_count = 8;
+
+	/** Returns the name of a boot stage. */
+	const char* to_string(boot_stage stage);
+
+	/** When every boot stage was first reached, in us since reset. */
+	class boot_timeline
+	{
+	public:
+		/** Records the time of a stage, if it's the first time it's reached.
+		 * Safe from any task or interrupt. */
+		void mark(boot_stage stage);
+
+		/** Returns when a stage was reached, or 0 if it hasn't been yet. */
+		uint32_t time_us(boot_stage stage) const
+		{
+			return times_[static_cast<size_t>(stage)];
+		}
+
+	private:
+		std::array<std::atomic<uint32_t>, boot_stage_count> times_ = {};
+	};
+
+	extern boot_timeline boot_times;
+}
+
+#endif//SCTU_BOOT_TIME_H_
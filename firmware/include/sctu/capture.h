@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_CAPTURE_H_
+#define SCTU_CAPTURE_H_
+
+#include <sctu/capture_frame.h>
+#include <sctu/controller.h>
+#include <sctu/filter.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace sctu
+{
+	/** Ring of records with a single producer and a single consumer.
+	 *
+	 * Neither side ever waits on the other, so the producer can be an
+	 * interrupt handler.
+	 *
+	 * @tparam size Number of records, must be a power of 2.
+	 */
+	template<size_t size>
+	class record_ring
+	{
+		static_assert(std::has_single_bit(size),
+			"The ring size must be a power of 2");
+
+	public:
+		/** Adds a record, producer only.
+		 *
+		 * @returns False if the ring is full.
+		 */
+		bool push(const capture_record& record)
+		{
+			const uint32_t head = head_.load(std::memory_order_relaxed);
+			if (head - tail_.load(std::memory_order_acquire) == size)
+				return false;
+			records_[head % size] = record;
+			head_.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/** Returns the oldest record without removing it, consumer only.
+		 *
+		 * @returns The record, or null if the ring is empty.
+		 */
+		const capture_record* peek() const
+		{
+			const uint32_t tail = tail_.load(std::memory_order_relaxed);
+			if (tail == head_.load(std::memory_order_acquire))
+				return nullptr;
+			return &records_[tail % size];
+		}
+
+		/** Removes the oldest record, consumer only. The ring must not be
+		 * empty. */
+		void pop()
+		{
+			tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+		}
+
+		/** Returns the number of records in the ring. */
+		size_t used() const
+		{
+			return head_.load(std::memory_order_acquire) -
+				tail_.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::array<capture_record, size> records_ = {};
+		std::atomic<uint32_t> head_ = 0;
+		std::atomic<uint32_t> tail_ = 0;
+	};
+
+	/** Streams every raw hub sample over CDC.
+	 *
+	 * The DMA interrupt handler stores each sample in a ring, and a
+	 * background task sends them in frames of capture records, see
+	 * capture_frame, with no formatting on the way. Samples that don't fit
+	 * in the ring are counted in the next frame. Use autopoll to capture at
+	 * a fixed, high rate.
+	 */
+	class capture_stream
+	{
+	public:
+		/** Capture statistics since boot. */
+		struct stats
+		{
+			/// Records sent over CDC.
+			uint32_t records;
+			/// Records lost to a full ring, or to nobody listening.
+			uint32_t dropped;
+		};
+
+		/** Starts the task that sends the records. */
+		void initialize_task();
+
+		/** Starts capturing. */
+		void start();
+
+		/** Stops capturing, records already captured are still sent. */
+		void stop();
+
+		/** Returns whether capturing is on. */
+		bool active() const
+		{
+			return active_;
+		}
+
+		/** Stores a sample, called from the DMA interrupt handler. */
+		void record(uint32_t time_us, std::span<const uint32_t, port_count> raw);
+
+		/** Returns the statistics of the capture. */
+		stats get_stats() const;
+
+	private:
+		static void task(void* capture);
+
+		/** Sends the next frame of records.
+		 *
+		 * @returns True if there may be more records to send.
+		 */
+		bool send_frame();
+
+		record_ring<256> ring_;
+		TaskHandle_t handle_ = nullptr;
+		std::atomic_bool active_ = false;
+		/// Producer side count of records that didn't fit.
+		std::atomic<uint32_t> overflows_ = 0;
+		/// Overflows already reported in a frame.
+		uint32_t reported_overflows_ = 0;
+		std::atomic<uint32_t> records_ = 0;
+		std::atomic<uint32_t> dropped_ = 0;
+		std::array<uint8_t,
+			sizeof(capture_frame) + max_frame_records * sizeof(capture_record)>
+			frame_;
+	};
+
+	/** Plays captured samples back in place of the hub.
+	 *
+	 * The CLI task feeds the records it gets from the host, and the
+	 * controller task takes them as they come due, keeping the time between
+	 * them as captured. Every record goes through the glitch filter, like live
+	 * samples do, so a replay gives the same reports as the original run.
+	 */
+	class replay_stream
+	{
+	public:
+		/** Replay statistics of the last replay. */
+		struct stats
+		{
+			/// Records played back.
+			uint32_t records;
+			/// Times the host didn't send records in time, and the buffer
+			/// ran dry. Each one delays the rest of the replay.
+			uint32_t underruns;
+		};
+
+		/** Starts a replay, the controller task switches to replayed samples
+		 * right away, with every player disconnected until the first record
+		 * plays.
+		 *
+		 * @returns False if a replay is still running.
+		 */
+		bool begin();
+
+		/** Adds a record to the replay, blocking while the buffer is full.
+		 *
+		 * Must only be called from the task that called begin().
+		 */
+		void feed(const capture_record& record);
+
+		/** Marks the end of the records, the replay stops once the
+		 * controller task has played them all. */
+		void end();
+
+		/** Ends the replay right away, the controller task drops the
+		 * records it didn't play yet and goes back to live samples. */
+		void cancel();
+
+		/** Returns whether a replay is running. */
+		bool active() const
+		{
+			return active_;
+		}
+
+		/** Plays every record that came due, must only be called from the
+		 * controller task.
+		 *
+		 * @param[in] filter_window Glitch filter window to apply.
+		 * @param[out] raw Set to the newest filtered sample played.
+		 *
+		 * @returns True if a record was played.
+		 */
+		bool next(unsigned filter_window, sample_filter::sample& raw);
+
+		/** Returns the statistics of the last replay. */
+		stats get_stats() const;
+
+	private:
+		record_ring<256> ring_;
+		sample_filter filter_;
+		std::atomic_bool active_ = false;
+		std::atomic_bool ending_ = false;
+		std::atomic_bool cancelled_ = false;
+		/// Controller task state, reset by begin(). Records are played when
+		/// they're as far from first_record_us_ as now is from start_us_.
+		bool started_ = false;
+		bool dry_ = false;
+		uint32_t first_record_us_ = 0;
+		uint32_t start_us_ = 0;
+		std::atomic<uint32_t> records_ = 0;
+		std::atomic<uint32_t> underruns_ = 0;
+	};
+
+	extern capture_stream capture;
+	extern replay_stream replay;
+}
+
+#endif//SCTU_CAPTURE_H_
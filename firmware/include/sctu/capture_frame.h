@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_CAPTURE_FRAME_H_
+#define SCTU_CAPTURE_FRAME_H_
+
+#include <sctu/controller.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace sctu
+{
+	/** A raw sample of the hub, as the DMA chain collected it, before the
+	 * glitch filter. */
+	struct capture_record
+	{
+		/// When the sample landed, from time_us_32().
+		uint32_t time_us;
+		/// Word of every port, see pio_controllers.
+		std::array<uint32_t, port_count> raw;
+	};
+
+	static_assert(sizeof(capture_record) == 4 * (1 + port_count),
+		"Capture records are sent as they are in memory");
+
+	/** Header of every frame of capture records sent over CDC, both by the
+	 * capture stream and by the host to replay.
+	 *
+	 * It's followed by count records, little endian, with no padding. A
+	 * frame with no records ends a replay.
+	 */
+	struct capture_frame
+	{
+		/// Always 0xA5 0x5C.
+		std::array<uint8_t, 2> sync;
+		/// Ports in every record, must match the firmware's port_count.
+		uint8_t ports;
+		/// Records following the header.
+		uint8_t count;
+		/// Records lost to a full buffer since the previous frame.
+		uint16_t dropped;
+	};
+
+	static_assert(sizeof(capture_frame) == 6);
+
+	constexpr const std::array<uint8_t, 2> capture_sync { 0xA5, 0x5C };
+
+	/// Most records in a frame.
+	constexpr const size_t max_frame_records = 32;
+}
+
+#endif//SCTU_CAPTURE_FRAME_H_
@@ -12,33 +12,109 @@
 
 #include <tusb.h>
 
+#include <FreeRTOS.h>
+#include <event_groups.h>
+#include <semphr.h>
+#include <stream_buffer.h>
+
 #include <sctu/io_device.h>
 
 namespace sctu
 {
 	/** IO device representing a TinyUSB CDC serial connection.
+	 *
+	 * TinyUSB must only be used from the USB task, so reads and writes only
+	 * go through a pair of stream buffers, which the USB task moves to and
+	 * from TinyUSB's FIFOs in update(). Writers and readers block on the
+	 * stream buffers, instead of spinning, until the USB task makes room or
+	 * brings in data.
+	 *
+	 * Writes are not flushed one by one: the USB task sends full packets as
+	 * the data comes in, and only sends a short packet once no write is in
+	 * progress and the buffer is empty. Use flush() to wait until everything
+	 * written so far has been handed to the host controller.
+	 *
+	 * While nobody is listening, writes fail and anything still buffered is
+	 * dropped, so output never piles up waiting for a terminal.
 	 */
 	class cdc_device : public io_device
 	{
 	public:
+		/// Bytes of output buffered for the USB task.
+		static constexpr size_t tx_buffer_size = 2048;
+		/// Bytes of input buffered for readers.
+		static constexpr size_t rx_buffer_size = 256;
+
+		/** Creates the buffers, must be called from a task before any other
+		 * member function, and before the USB task starts.
+		 */
+		void initialize();
+
+		/** Blocks until a terminal is connected. */
 		bool open() override;
 
 		bool close() override;
 
-		/** Updates the connected status of the TinyUSB CDC device.
+		/** Moves data between the buffers and TinyUSB, and updates the
+		 * connected status of the TinyUSB CDC device.
 		 *
-		 * This can be called from multiple threads, but it really needs to be
-		 * called from the same thread/task as the main tud_task call.
+		 * This must be called from the same thread/task as the main tud_task
+		 * call.
 		 */
 		void update();
 
+		/** Queues data for the USB task.
+		 *
+		 * This blocks while the buffer is full, for up to write_timeout at a
+		 * time, so a terminal that stops reading can't hang the writer.
+		 */
 		int write(std::span<const unsigned char> data) override;
 
+		/** Blocks until there is data to read, then reads what's available. */
 		int read(std::span<unsigned char> buffer) override;
 
+		/** Reads what's available, waiting up to timeout for something to
+		 * arrive. Doesn't wait for a terminal to connect.
+		 *
+		 * @returns The number of bytes read, 0 on a timeout.
+		 */
+		int read(std::span<unsigned char> buffer, TickType_t timeout);
+
+		/** Blocks until every byte written has been handed to TinyUSB and its
+		 * FIFO is empty, or the terminal goes away.
+		 *
+		 * @returns False if it timed out with data still pending.
+		 */
+		bool flush() override;
+
 	private:
+		static constexpr const EventBits_t connected_bit = 1 << 0;
+		static constexpr const EventBits_t drained_bit = 1 << 1;
+
+		/// How long a write waits for the USB task to make room.
+		static constexpr const TickType_t write_timeout = pdMS_TO_TICKS(100);
+		/// How long a flush waits for the USB task to drain the buffer.
+		static constexpr const TickType_t flush_timeout = pdMS_TO_TICKS(500);
+
 		/// Atomic flag indicating whether the USB CDC device is connected.
 		std::atomic_bool connected_ = false;
+		/// Whether a write is copying into the buffer, see update().
+		std::atomic_bool writing_ = false;
+		/// Whether TinyUSB's FIFO was empty when last checked.
+		std::atomic_bool fifo_empty_ = true;
+
+		StreamBufferHandle_t tx_ = nullptr;
+		StreamBufferHandle_t rx_ = nullptr;
+		/// Stream buffers only support one writer at a time.
+		SemaphoreHandle_t write_lock_ = nullptr;
+		EventGroupHandle_t events_ = nullptr;
+
+		std::array<uint8_t, tx_buffer_size + 1> tx_storage_;
+		std::array<uint8_t, rx_buffer_size + 1> rx_storage_;
+		StaticStreamBuffer_t tx_buffer_;
+		StaticStreamBuffer_t rx_buffer_;
+		StaticSemaphore_t write_lock_buffer_;
+		StaticEventGroup_t events_buffer_;
 	};
 
 	extern cdc_device cdc;
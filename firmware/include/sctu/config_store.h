@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_CONFIG_STORE_H_
+#define SCTU_CONFIG_STORE_H_
+
+#include <sctu/controller.h>
+#include <sctu/input_transform.h>
+#include <sctu/settings.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace sctu
+{
+	/** Everything kept across reboots, as laid out in flash.
+	 *
+	 * The defaults match those of settings and input_transform, so a blank
+	 * store boots the same as before there was one. Bump version whenever
+	 * the layout changes, older records are then ignored.
+	 */
+	struct stored_config
+	{
+		static constexpr const uint16_t version = 1;
+
+		uint16_t autopoll_hz = 0;
+		uint16_t sof_lead_us = 500;
+		uint16_t filter_budget_us = 1000;
+		uint8_t report_interval_ms = 10;
+		bool sof_sync = false;
+		hid_layout layout = hid_layout::dynamic;
+		uint8_t filter_samples = 3;
+		std::array<transform_config, max_players> transforms = {};
+	};
+
+	static_assert(std::is_trivially_copyable_v<stored_config>,
+		"The configuration is copied straight out of flash");
+
+	constexpr const stored_config default_config;
+
+	/** Wear levelled store of the configuration, in the last sectors of
+	 * flash.
+	 *
+	 * Every save goes to the next slot of a ring of slots, each one tagged
+	 * with a sequence number and a CRC, so the newest valid slot is the
+	 * configuration and a save cut short by a reset leaves the previous one
+	 * in place. A sector is only erased when the ring gets back to it.
+	 * Reading is done through XIP, writing stops both cores for a few ms per
+	 * page, and up to tens of ms for an erase.
+	 */
+	class config_store
+	{
+	public:
+		/// Sectors at the end of flash used by the store.
+		static constexpr const size_t sectors = 4;
+
+		/** Store statistics since boot. */
+		struct stats
+		{
+			/// Slot holding the current configuration, or -1 if none.
+			int slot;
+			/// Sequence number of the current configuration.
+			uint32_t sequence;
+			uint32_t saves;
+			uint32_t erases;
+		};
+
+		/** Finds the newest valid configuration.
+		 *
+		 * @param[out] config Set to the configuration, or to the defaults
+		 *  if none was found.
+		 *
+		 * @returns True if a stored configuration was found.
+		 */
+		bool load(stored_config& config);
+
+		/** Saves a configuration to the next slot.
+		 *
+		 * Must not be called before load().
+		 *
+		 * @returns True if the configuration was written and reads back.
+		 */
+		bool save(const stored_config& config);
+
+		/** Erases every slot, the next boot uses the defaults. */
+		bool erase();
+
+		/** Returns the statistics of the store. */
+		stats get_stats() const;
+
+	private:
+		int slot_ = -1;
+		uint32_t sequence_ = 0;
+		uint32_t saves_ = 0;
+		uint32_t erases_ = 0;
+	};
+
+	/** Loads the stored configuration into system_settings and
+	 * input_transforms.
+	 *
+	 * Must be called at boot, before the USB and controller tasks start, so
+	 * the host enumerates the stored configuration first.
+	 *
+	 * @returns True if a stored configuration was found.
+	 */
+	bool load_settings();
+
+	/** Saves the current system_settings and input_transforms. */
+	bool save_settings();
+
+	extern config_store settings_store;
+}
+
+#endif//SCTU_CONFIG_STORE_H_
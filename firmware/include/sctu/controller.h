@@ -5,10 +5,32 @@
 #ifndef SCTU_CONTROLLER_H_
 #define SCTU_CONTROLLER_H_
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 
+// Number of physical controller ports, set by the build. Ports past the
+// fourth are driven by the second PIO block.
+#ifndef SCTU_PORT_COUNT
+#define SCTU_PORT_COUNT 4
+#endif
+
 namespace sctu
 {
+	/// Number of physical controller ports on the hub.
+	constexpr const size_t port_count = SCTU_PORT_COUNT;
+
+	static_assert(port_count >= 1 && port_count <= 8,
+		"Two PIO blocks can drive at most 8 ports");
+
+	/// Number of players the hub can report. Every port carries a second
+	/// player on its DATA1 line when a multitap style device is attached.
+	/// Players [0, port_count) are on DATA0 of each port, and players
+	/// [port_count, max_players) are on DATA1 of each port. USB limits this
+	/// to 8 players, so with more than 4 ports only some DATA1 lines are
+	/// used.
+	constexpr const size_t max_players = std::min<size_t>(2 * port_count, 8);
+
 	/** Represents SNES controller state.
 	 */
 	struct controller
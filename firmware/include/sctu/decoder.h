@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_DECODER_H_
+#define SCTU_DECODER_H_
+
+#include <sctu/controller.h>
+
+#include <array>
+#include <cstdint>
+
+namespace sctu
+{
+	/** The two bit streams interleaved in a raw PIO word.
+	 *
+	 * Both are in shift order, the first bit clocked out is bit 0, and both
+	 * are active low, as they come off the bus.
+	 */
+	struct bit_streams
+	{
+		/// DATA0: B Y SELECT START UP DOWN LEFT RIGHT A X L R, then the 4
+		/// bit ID.
+		uint16_t data0;
+		/// DATA1, only driven by multitaps and some special controllers.
+		uint16_t data1;
+	};
+
+	/** Kind of device driving a bit stream, based on its ID bits.
+	 */
+	enum class device_type : uint8_t
+	{
+		/// Nothing is driving the line.
+		none,
+		/// Standard controller.
+		gamepad,
+		/// SNES mouse.
+		mouse,
+		/// NTT Data Keypad.
+		ntt_data_pad,
+		/// A device with an ID we don't know about.
+		other,
+	};
+
+	/** Identifies the device driving a bit stream from the 4 ID bits that
+	 * follow the 12 buttons.
+	 *
+	 * Only the first 16 bits of a device are clocked, so devices that send
+	 * more, like the mouse and the NTT Data Keypad, are identified but their
+	 * extra bits aren't read.
+	 *
+	 * @param[in] stream Active low DATA0 or DATA1 stream, see bit_streams.
+	 *
+	 * @returns The kind of device.
+	 */
+	device_type identify(uint16_t stream);
+
+	/** Splits a raw PIO word into its DATA0 (even bits) and DATA1 (odd bits)
+	 * streams.
+	 *
+	 * @param[in] data Interleaved DATA0/DATA1 word pushed by the PIO.
+	 *
+	 * @returns Both bit streams.
+	 */
+	bit_streams deinterleave(uint32_t data);
+
+	/** Decodes a standard controller bit stream into a controller state.
+	 *
+	 * @param[in] stream Active low DATA0 or DATA1 stream, see bit_streams.
+	 *
+	 * @returns The decoded controller state, disconnected if the stream
+	 *  isn't from a standard controller.
+	 */
+	controller decode_stream(uint16_t stream);
+
+	/** Decodes a raw PIO word into a controller state.
+	 *
+	 * This uses lookup tables, and has no branches.
+	 *
+	 * @param[in] data Interleaved DATA0/DATA1 word pushed by the PIO.
+	 *
+	 * @returns The decoded controller state.
+	 */
+	controller decode(uint32_t data);
+
+	/** Decodes all raw PIO words collected by the DMA chain, both the DATA0
+	 * and DATA1 streams of every port.
+	 *
+	 * @param[in] data Words from each state machine, in port order.
+	 *
+	 * @returns The decoded controller states, in player order (see
+	 *  max_players).
+	 */
+	std::array<controller, max_players> decode(
+		const std::array<uint32_t, port_count>& data);
+
+	/** Decodes a raw PIO word one bit at a time.
+	 *
+	 * This is the straightforward version of decode(), kept as a reference
+	 * to check and benchmark the table driven one against.
+	 *
+	 * @param[in] data Interleaved DATA0/DATA1 word pushed by the PIO.
+	 *
+	 * @returns The decoded controller state.
+	 */
+	controller decode_reference(uint32_t data);
+}
+
+#endif//SCTU_DECODER_H_
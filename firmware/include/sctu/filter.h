@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_FILTER_H_
+#define SCTU_FILTER_H_
+
+#include <sctu/controller.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace sctu
+{
+	/// Largest majority filter window supported, in samples.
+	constexpr const unsigned max_filter_samples = 7;
+
+	/** Bitwise majority vote over a window of raw samples.
+	 *
+	 * Every bit of the result is set if that bit is set in more than half of
+	 * the samples. This is done with a bit-sliced counter, so all 32 bits of
+	 * a word are voted on at once, without branches. A glitch shorter than
+	 * half the window never makes it to the output, and real edges are
+	 * delayed by (samples - 1) / 2 samples.
+	 *
+	 * @param[in] samples Odd number of samples, at most max_filter_samples.
+	 *
+	 * @returns The majority of every bit.
+	 */
+	uint32_t majority(std::span<const uint32_t> samples);
+
+	/** Works out the filter window that fits in a latency budget.
+	 *
+	 * @param[in] requested Requested window in samples.
+	 * @param[in] period_us Time between samples, in us.
+	 * @param[in] budget_us Maximum latency the filter may add, in us.
+	 *
+	 * @returns The largest odd window, no larger than requested, whose added
+	 *  latency fits in the budget. 1 means no filtering.
+	 */
+	constexpr unsigned filter_samples(
+		unsigned requested, unsigned period_us, unsigned budget_us)
+	{
+		unsigned samples = (std::clamp(requested, 1u, max_filter_samples) - 1) | 1;
+		while (samples > 1 && (samples - 1) / 2 * period_us > budget_us)
+			samples -= 2;
+		return samples;
+	}
+
+	/** Glitch filter over a stream of hub samples.
+	 *
+	 * Keeps the last max_filter_samples raw samples, and replaces every new
+	 * one with the bitwise majority of the last window() of them, see
+	 * majority(). This covers every bit, including the ID bits used to detect
+	 * connections.
+	 *
+	 * Only one context may apply() the filter, the window can be changed
+	 * from anywhere and is used from the next sample on.
+	 */
+	class sample_filter
+	{
+	public:
+		using sample = std::array<uint32_t, port_count>;
+
+		/** Sets the window.
+		 *
+		 * @param[in] samples Window in samples, rounded down to an odd number
+		 *  and clamped to [1, max_filter_samples]. 1 disables filtering.
+		 */
+		void set_window(unsigned samples)
+		{
+			samples = std::clamp(samples, 1u, max_filter_samples);
+			window_ = (samples - 1) | 1;
+		}
+
+		/** Returns the window, in samples. */
+		unsigned window() const
+		{
+			return window_;
+		}
+
+		/** Adds a raw sample to the history, and filters it in place. */
+		void apply(sample& raw);
+
+	private:
+		/// Unfiltered samples, most recent at next_ - 1.
+		std::array<sample, max_filter_samples> history_ = {};
+		size_t next_ = 0;
+		std::atomic<uint8_t> window_ = 1;
+	};
+
+	static_assert(filter_samples(3, 250, 1000) == 3);
+	static_assert(filter_samples(7, 10000, 1000) == 1);
+	static_assert(filter_samples(8, 100, 1000) == 7);
+	static_assert(filter_samples(4, 100, 10000) == 3);
+}
+
+#endif//SCTU_FILTER_H_
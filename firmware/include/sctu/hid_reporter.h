@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_HID_REPORTER_H_
+#define SCTU_HID_REPORTER_H_
+
+#include <sctu/controller.h>
+#include <sctu/latency.h>
+#include <sctu/report.h>
+#include <sctu/snapshot.h>
+
+#include <tusb_config.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace sctu
+{
+	/** Turns controller samples into HID reports.
+	 *
+	 * The controller task publishes every sample here, and the USB task sends
+	 * the reports. TinyUSB is not thread safe, so this keeps every TinyUSB
+	 * call in the USB task, and lets the controller task run on the other
+	 * core without ever waiting on USB.
+	 *
+	 * Reports are only sent when their bytes change, unless the host set an
+	 * idle rate for the interface with SET_IDLE, in which case an unchanged
+	 * report is repeated at that rate.
+	 */
+	class hid_reporter
+	{
+	public:
+		using report = hid_report;
+
+		/** Publishes the newest state of every controller.
+		 *
+		 * This never blocks, but it must only be called from a single task.
+		 *
+		 * @param[in] state Latest state of the hub, one state per player.
+		 * @param[in] times Times of the sample the state came from, used to
+		 *  time reports, see latency_tracker.
+		 */
+		void publish(
+			const std::array<controller, max_players>& state,
+			const sample_times& times = {});
+
+		/** Sends reports for any controller whose state changed, or whose
+		 * idle period expired.
+		 *
+		 * This must be called from the USB task.
+		 */
+		void update();
+
+		/** Handles a HID SET_IDLE request, must be called from the USB task.
+		 *
+		 * @param[in] instance HID instance the request is for.
+		 * @param[in] idle_rate Idle rate in 4 ms units, 0 for only reporting
+		 *  changes.
+		 */
+		void set_idle(uint8_t instance, uint8_t idle_rate);
+
+		/** Handles a HID GET_REPORT request, must be called from the USB task.
+		 *
+		 * @param[in] instance HID instance the request is for.
+		 * @param[in] report_id Requested report ID, only used in the combined
+		 *  layout.
+		 * @param[out] buffer Where to write the report, without report ID.
+		 *
+		 * @returns The length of the report, or 0 if there's no such report.
+		 */
+		uint16_t get_report(
+			uint8_t instance, uint8_t report_id, std::span<uint8_t> buffer);
+
+	private:
+		/** A published sample. */
+		struct sample
+		{
+			std::array<controller, max_players> state;
+			sample_times times;
+		};
+
+		snapshot<sample> state_;
+
+		/// Sequence of the last state seen by update().
+		uint32_t sequence_ = 0;
+		/// Last report sent for each controller.
+		std::array<report, max_players> reported_ = {};
+		/// When each controller's last report was sent.
+		std::array<TickType_t, max_players> sent_ = {};
+		/// Idle rate of each HID instance, in 4 ms units.
+		std::array<uint8_t, CFG_TUD_HID> idle_rates_ = {};
+		/// Controller to try first, rotated so none can starve the others.
+		uint8_t first_ = 0;
+	};
+
+	extern hid_reporter hid_reports;
+}
+
+#endif//SCTU_HID_REPORTER_H_
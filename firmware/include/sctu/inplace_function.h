@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_INPLACE_FUNCTION_H_
+#define SCTU_INPLACE_FUNCTION_H_
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sctu
+{
+	template<class Signature, size_t capacity = 4 * sizeof(void*)>
+	class inplace_function;
+
+	/** A std::function that never allocates.
+	 *
+	 * The callable is kept inside the object, so it must fit in capacity
+	 * bytes. To keep this small, only trivially copyable and destructible
+	 * callables are supported, like function pointers and lambdas capturing
+	 * pointers and integers, both of which are checked at compile time.
+	 *
+	 * @tparam Result Return type of the function.
+	 * @tparam Args Argument types of the function.
+	 * @tparam capacity Bytes available for the callable.
+	 */
+	template<class Result, class... Args, size_t capacity>
+	class inplace_function<Result(Args...), capacity>
+	{
+	public:
+		inplace_function() = default;
+
+		template<class Func>
+			requires (!std::is_same_v<std::remove_cvref_t<Func>, inplace_function>)
+		inplace_function(Func func)
+		{
+			*this = func;
+		}
+
+		template<class Func>
+			requires (!std::is_same_v<std::remove_cvref_t<Func>, inplace_function>)
+		inplace_function& operator=(Func func)
+		{
+			static_assert(sizeof(Func) <= capacity,
+				"Callable is too large for this inplace_function");
+			static_assert(alignof(Func) <= alignof(std::max_align_t),
+				"Callable is over-aligned for inplace_function");
+			static_assert(std::is_trivially_copyable_v<Func> &&
+				std::is_trivially_destructible_v<Func>,
+				"inplace_function only holds trivially copyable callables");
+
+			::new (storage_.data()) Func(func);
+			invoke_ = [](const void *storage, Args... args) -> Result
+			{
+				return (*static_cast<const Func*>(storage))(
+					std::forward<Args>(args)...);
+			};
+			return *this;
+		}
+
+		Result operator()(Args... args) const
+		{
+			return invoke_(storage_.data(), std::forward<Args>(args)...);
+		}
+
+		explicit operator bool() const
+		{
+			return invoke_ != nullptr;
+		}
+
+	private:
+		alignas(std::max_align_t) std::array<unsigned char, capacity> storage_ = {};
+		Result (*invoke_)(const void*, Args...) = nullptr;
+	};
+}
+
+#endif//SCTU_INPLACE_FUNCTION_H_
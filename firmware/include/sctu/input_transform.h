@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_INPUT_TRANSFORM_H_
+#define SCTU_INPUT_TRANSFORM_H_
+
+#include <sctu/controller.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace sctu
+{
+	/// Names of the bits of controller::buttons, lowest bit first.
+	constexpr const std::array<std::string_view, 8> button_names {
+		"b", "y", "select", "start", "a", "x", "l", "r" };
+
+	/** Parses a set of buttons, their names joined by '+', like "a+b".
+	 *
+	 * @param[in] text Buttons to parse, "-" for none.
+	 *
+	 * @returns The buttons as a controller::buttons mask, or -1 if a name is
+	 *  unknown.
+	 */
+	int parse_buttons(std::string_view text);
+
+	/** Formats a controller::buttons mask the way parse_buttons() reads it.
+	 *
+	 * @param[in] buttons Buttons to format.
+	 * @param[out] buffer Where to write the text, always null terminated.
+	 *
+	 * @returns The text written.
+	 */
+	std::string_view format_buttons(uint8_t buttons, std::span<char> buffer);
+
+	/// Most steps in a macro.
+	constexpr const size_t max_macro_steps = 24;
+
+	/** One step of a macro: buttons held for a while. */
+	struct macro_step
+	{
+		uint8_t buttons;
+		uint16_t duration_ms;
+	};
+
+	/** Transforms applied to a player's buttons, as edited from the CLI.
+	 *
+	 * Buttons are first remapped, and everything else works on the
+	 * remapped buttons.
+	 */
+	struct transform_config
+	{
+		/// Buttons each input button presses, indexed by bit. Identity is
+		/// 1 << bit, and several bits or none are allowed.
+		std::array<uint8_t, 8> remap { 1, 2, 4, 8, 16, 32, 64, 128 };
+		/// Buttons that repeat while held.
+		uint8_t turbo = 0;
+		/// Presses per second of the turbo buttons.
+		uint8_t turbo_hz = 15;
+		/// Buttons that, pressed together, play the macro. 0 disables it.
+		uint8_t macro_trigger = 0;
+		uint8_t macro_length = 0;
+		std::array<macro_step, max_macro_steps> macro = {};
+
+		/** Returns whether this leaves the buttons alone. */
+		bool identity() const;
+	};
+
+	/** Turbo, remapping and macros, applied to every sample between decoding
+	 * and the HID reports.
+	 *
+	 * Every player's configuration is compiled into lookup tables, so
+	 * applying them costs the same whatever is configured, and nothing is
+	 * allocated. The controller task applies one bank of tables while the
+	 * CLI compiles edits into the other one, and then swaps them. Timing
+	 * comes from the sample timestamps, so turbo and macros line up with the
+	 * samples the host gets.
+	 */
+	class input_transform
+	{
+	public:
+		/** Applies the transforms to every player, from the controller task
+		 * only.
+		 *
+		 * @param[in,out] state Decoded state of every player.
+		 * @param[in] now_us When the sample was taken, from time_us_32().
+		 */
+		void apply(std::array<controller, max_players>& state, uint32_t now_us);
+
+		/** Returns the configuration of a player. */
+		const transform_config& config(size_t player) const
+		{
+			return configs_[player];
+		}
+
+		/** Changes the configuration of a player, it's used from the next
+		 * sample on.
+		 *
+		 * Blocks until the controller task is done with the previous change.
+		 * Only one task may change configurations.
+		 */
+		void set_config(size_t player, const transform_config& config);
+
+		/** Replaces the configuration of every player at once, without
+		 * waiting on the controller task. Only for use before it starts.
+		 */
+		void initialize(const std::array<transform_config, max_players>& configs);
+
+		/** Starts recording the buttons of a player, after remapping, as a
+		 * macro. The first step is the first button press.
+		 *
+		 * @returns False if a recording is already running.
+		 */
+		bool start_recording(size_t player);
+
+		/** Stops recording and makes what was recorded the player's macro.
+		 *
+		 * @param[in] trigger Buttons that play the macro, 0 keeps the ones
+		 *  the player had.
+		 *
+		 * @returns Number of steps recorded.
+		 */
+		size_t stop_recording(uint8_t trigger);
+
+		/** Returns the player being recorded, or -1. */
+		int recording() const
+		{
+			return recording_;
+		}
+
+	private:
+		/** Compiled configuration of a player. */
+		struct table
+		{
+			/// Remapped buttons for every input.
+			std::array<uint8_t, 256> remap = []
+			{
+				std::array<uint8_t, 256> identity;
+				for (size_t i = 0; i < identity.size(); ++i)
+					identity[i] = i;
+				return identity;
+			}();
+			uint8_t turbo = 0;
+			uint8_t trigger = 0;
+			uint8_t length = 0;
+			/// Half of the turbo period, in us.
+			uint32_t turbo_half_us = 0;
+			/// Buttons of every step, and when it ends in us since the start
+			/// of the macro.
+			std::array<uint8_t, max_macro_steps> step_buttons = {};
+			std::array<uint32_t, max_macro_steps> step_end_us = {};
+		};
+
+		/** State of a player kept between samples. */
+		struct player_state
+		{
+			uint8_t previous;
+			bool playing;
+			uint8_t step;
+			uint32_t macro_start_us;
+			std::array<uint32_t, 8> turbo_start_us;
+		};
+
+		/** A recorded change of buttons. */
+		struct recorded_step
+		{
+			uint8_t buttons;
+			uint32_t start_us;
+		};
+
+		static table compile(const transform_config& config);
+
+		/** Waits until the controller task uses the newest bank. */
+		void wait_for_bank() const;
+
+		void record(uint8_t buttons, uint32_t now_us);
+
+		std::array<std::array<table, max_players>, 2> banks_ = {};
+		std::atomic<uint8_t> active_ = 0;
+		/// Bank the controller task last applied.
+		std::atomic<uint8_t> in_use_ = 0;
+		/// Editor side copy of every configuration.
+		std::array<transform_config, max_players> configs_ = {};
+
+		/// Controller task only.
+		std::array<player_state, max_players> players_ = {};
+
+		/// Player being recorded, set by the editor.
+		std::atomic<int8_t> recording_ = -1;
+		/// Player the controller task last recorded, or -1.
+		std::atomic<int8_t> recording_ack_ = -1;
+		std::array<recorded_step, max_macro_steps> recorded_ = {};
+		std::atomic<uint8_t> recorded_length_ = 0;
+	};
+
+	extern input_transform input_transforms;
+}
+
+#endif//SCTU_INPUT_TRANSFORM_H_
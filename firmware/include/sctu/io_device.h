@@ -57,6 +57,12 @@ namespace sctu
 		 *  (errno should also be set to something sensible).
 		 */
 		virtual int read(std::span<unsigned char> buffer) = 0;
+
+		/** Waits until everything written so far has left the device.
+		 *
+		 * @returns True on success, false otherwise.
+		 */
+		virtual bool flush() = 0;
 	};
 }
 
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_LATENCY_H_
+#define SCTU_LATENCY_H_
+
+#include <tusb_config.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace sctu
+{
+	/** When a controller sample went through each stage, from time_us_32().
+	 */
+	struct sample_times
+	{
+		/// The sample was requested from the PIO.
+		uint32_t trigger_us;
+		/// The DMA chain finished collecting it.
+		uint32_t ready_us;
+		/// The controller task decoded it.
+		uint32_t decoded_us;
+		/// When the loopback tester changed the input this sample is the
+		/// first to see, 0 if none.
+		uint32_t stimulus_us;
+	};
+
+	/** Histogram of latencies, in us.
+	 *
+	 * Latencies below sub_buckets us are kept exactly, and every power of 2
+	 * above that is split in sub_buckets buckets, so any latency is known to
+	 * within 12.5%, which is plenty for percentiles, in a few hundred bytes.
+	 *
+	 * Only one task may record into a histogram. Readers copy it through a
+	 * sequence counter, so they always see a consistent copy, and a reset is
+	 * only a request carried out by the next record().
+	 */
+	class latency_histogram
+	{
+	public:
+		static constexpr unsigned sub_bits = 3;
+		static constexpr uint32_t sub_buckets = 1u << sub_bits;
+
+		/// Longest latency told apart from others, anything longer lands in
+		/// the last bucket.
+		static constexpr uint32_t max_us = (1u << 20) - 1;
+
+		/** Returns the bucket a latency falls into. */
+		static constexpr size_t bucket(uint32_t us)
+		{
+			us = std::min(us, max_us);
+			if (us < sub_buckets)
+				return us;
+			const unsigned shift = std::bit_width(us) - 1 - sub_bits;
+			return (shift + 1) * sub_buckets + ((us >> shift) & (sub_buckets - 1));
+		}
+
+		/** Returns the shortest latency in a bucket. */
+		static constexpr uint32_t bucket_floor(size_t bucket)
+		{
+			if (bucket < sub_buckets)
+				return bucket;
+			const unsigned shift = bucket / sub_buckets - 1;
+			return (sub_buckets + bucket % sub_buckets) << shift;
+		}
+
+		/// One bucket per exact latency, and sub_buckets per power of 2
+		/// above that, up to max_us.
+		static constexpr size_t bucket_count =
+			(std::bit_width(max_us) - sub_bits + 1) * sub_buckets;
+
+		/** Consistent copy of a histogram.
+		 *
+		 * Only 32 bit fields, so it can be dumped as is, see the CLI 't dump'
+		 * command.
+		 */
+		struct copy
+		{
+			uint32_t count;
+			uint32_t min_us;
+			uint32_t max_us;
+			/// Sum of every latency, split in two words.
+			uint32_t sum_low;
+			uint32_t sum_high;
+			std::array<uint32_t, bucket_count> buckets;
+		};
+
+		/** Summary of a histogram, in us. */
+		struct summary
+		{
+			uint32_t count;
+			uint32_t min_us;
+			uint32_t average_us;
+			uint32_t p99_us;
+			uint32_t max_us;
+		};
+
+		/** Adds a latency to the histogram, see the class notes. */
+		void record(uint32_t us);
+
+		/** Returns a consistent copy of the histogram. */
+		copy read() const;
+
+		/** Returns the summary of the histogram. */
+		summary summarize() const;
+
+		/** Asks the recording task to clear the histogram. */
+		void reset();
+
+	private:
+		std::atomic<uint32_t> sequence_ = 0;
+		std::atomic_bool reset_requested_ = false;
+		std::atomic<uint32_t> count_ = 0;
+		std::atomic<uint32_t> min_ = UINT32_MAX;
+		std::atomic<uint32_t> max_ = 0;
+		std::atomic<uint32_t> sum_low_ = 0;
+		std::atomic<uint32_t> sum_high_ = 0;
+		std::array<std::atomic<uint32_t>, bucket_count> buckets_ = {};
+	};
+
+	/** Stages of the input path timed by the latency tracker. */
+	enum class latency_stage : uint8_t
+	{
+		/// PIO trigger to the sample landing in memory.
+		trigger_to_ready,
+		/// Sample landing to the controller task having decoded it.
+		ready_to_decoded,
+		/// Decoding to the report being queued with TinyUSB.
+		decoded_to_queued,
+		/// Queueing to the host picking up the report.
+		queued_to_complete,
+		/// PIO trigger to the host picking up the report.
+		total,
+		/// Loopback input change to the host picking up the report.
+		loopback,
+	};
+
+	constexpr const size_t latency_stage_count = 6;
+
+	/** Returns the name of a latency stage. */
+	const char* to_string(latency_stage stage);
+
+	/** Times controller samples on their way to the host.
+	 *
+	 * Only reports whose contents changed are timed, as repeats of an old
+	 * report say nothing about how fast input gets through.
+	 */
+	class latency_tracker
+	{
+	public:
+		/** Records the stages up to decoding, must be called from the
+		 * controller task once per new sample. */
+		void sample_decoded(const sample_times& times);
+
+		/** Records that a changed report was queued, must be called from the
+		 * USB task.
+		 *
+		 * @param[in] instance HID instance the report was queued on.
+		 * @param[in] times Times of the sample the report came from.
+		 */
+		void report_queued(uint8_t instance, const sample_times& times);
+
+		/** Records that the host picked up a report, must be called from the
+		 * USB task.
+		 *
+		 * @param[in] instance HID instance the report was sent on.
+		 */
+		void report_complete(uint8_t instance);
+
+		/** Returns the histogram of a stage. */
+		const latency_histogram& histogram(latency_stage stage) const;
+
+		/** Clears every histogram. */
+		void reset();
+
+	private:
+		std::array<latency_histogram, latency_stage_count> histograms_;
+
+		/// Sample behind each instance's pending report, and when it was
+		/// queued, 0 when none is pending.
+		std::array<sample_times, CFG_TUD_HID> pending_ = {};
+		std::array<uint32_t, CFG_TUD_HID> queued_us_ = {};
+	};
+
+	extern latency_tracker latency;
+}
+
+#endif//SCTU_LATENCY_H_
@@ -9,7 +9,7 @@
 
 namespace sctu
 {
-	extern safe_syslog<syslog<1024*128>> sys_log;
+	extern syslog<1024*8> sys_log;
 }
 
 #endif//SCTU_LOG_H_
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_LOG_DRAIN_H_
+#define SCTU_LOG_DRAIN_H_
+
+#include <sctu/log.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace sctu
+{
+	/** Streams new system log records to the serial outputs.
+	 *
+	 * Pushing to the log only wakes up the drain task, which then copies the
+	 * new records out of the log, formats them in batches, and writes each
+	 * batch to CDC, and to the UART if the firmware was built with
+	 * SCTU_LOG_UART. Logging never waits on a serial port this way, whether a
+	 * terminal is attached or not.
+	 *
+	 * If the drain falls behind and the log overwrites records before they're
+	 * sent, the gap is counted and reported in the output instead.
+	 *
+	 * In binary mode records are sent as they are in the log, for a host to
+	 * format: two sync bytes, 0xA5 0x5A, then the record header and the rest
+	 * of the record, see syslog::header. Format strings and string arguments
+	 * are addresses, resolved against the firmware's ELF file. A gap in the
+	 * sequence numbers means records were dropped.
+	 */
+	class log_drain
+	{
+	public:
+		/** Drain statistics since boot. */
+		struct stats
+		{
+			/// Records sent to the outputs.
+			uint32_t records;
+			/// Records overwritten in the log before they could be sent.
+			uint32_t dropped;
+			/// Records a connected output couldn't take in time.
+			uint32_t sink_dropped;
+		};
+
+		/** Starts the drain task, and hooks it to the system log. */
+		void initialize_task();
+
+		/** Returns the statistics of the drain. */
+		stats get_stats() const;
+
+		/** Selects between formatted text and binary output. */
+		void set_binary(bool binary);
+
+		/** Returns whether the output is binary. */
+		bool binary() const;
+
+		/** Stops or resumes sending records over CDC, e.g. while the CLI is
+		 * in JSON lines mode or capturing and owns the stream. Records are still taken
+		 * out of the log and sent to the UART, and stay readable in the log
+		 * itself.
+		 */
+		void set_cdc_muted(bool muted);
+
+		/** Returns whether records are kept off CDC. */
+		bool cdc_muted() const;
+
+	private:
+		static void task(void* drain);
+
+		/** Sends the next batch of records.
+		 *
+		 * @returns True if there may be more records to send.
+		 */
+		bool drain_batch();
+
+		/** Adds the next record to the batch as text.
+		 *
+		 * @returns The number of bytes added.
+		 */
+		size_t format_next(std::span<char> batch);
+
+		/** Adds the next record to the batch in binary.
+		 *
+		 * @returns The number of bytes added.
+		 */
+		size_t copy_next(std::span<char> batch);
+
+		/** Writes a batch to CDC.
+		 *
+		 * @returns False if the terminal is attached, but couldn't take the
+		 *  whole batch.
+		 */
+		static bool write_cdc(std::span<const unsigned char> batch);
+
+		/// Longest formatted record, with its prefix, a gap notice, and line
+		/// ending, or longest binary record.
+		static constexpr size_t max_line_size = std::max(
+			decltype(sys_log)::max_record_size + 64,
+			decltype(sys_log)::max_raw_size + 2);
+
+		TaskHandle_t handle_ = nullptr;
+		decltype(sys_log)::cursor cursor_ = 0;
+		/// Sequence number of the next record expected from the log.
+		uint32_t next_ = 0;
+		std::array<char, decltype(sys_log)::max_record_size> record_;
+		std::array<char, 1024> batch_;
+
+		std::atomic_bool binary_ = false;
+		std::atomic_bool cdc_muted_ = false;
+		std::atomic<uint32_t> records_ = 0;
+		std::atomic<uint32_t> dropped_ = 0;
+		std::atomic<uint32_t> sink_dropped_ = 0;
+	};
+
+	extern log_drain sys_log_drain;
+}
+
+#endif//SCTU_LOG_DRAIN_H_
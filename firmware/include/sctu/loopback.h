@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_LOOPBACK_H_
+#define SCTU_LOOPBACK_H_
+
+#include <hardware/pio.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	/** Plays a controller back into the hub, to time the whole input path.
+	 *
+	 * A state machine on pio1 emulates a standard controller on
+	 * loopback_pin (see board.h), which must be wired to the DATA0 pin of an
+	 * empty port. Every button change is timestamped, and the controller task
+	 * tags the first sample showing it, so the latency tracker can time
+	 * button changes all the way to the host picking up the report, through
+	 * the real bus, sampling, filtering and USB paths.
+	 *
+	 * Only B is ever pressed. Other controllers should be left alone while
+	 * testing, as a change to B on any of them looks like the loopback's.
+	 */
+	class loopback_tester
+	{
+	public:
+		/** Starts emulating a released controller.
+		 *
+		 * @returns True on success, false if the board has no loopback pin, or
+		 *  pio1 has no state machine or program space left.
+		 */
+		bool start();
+
+		/** Stops emulating the controller and releases the pin. */
+		void stop();
+
+		/** Returns whether the emulated controller is running. */
+		bool active() const
+		{
+			return active_;
+		}
+
+		/** Presses or releases B on the emulated controller.
+		 *
+		 * The change shows up on the bus from the next latch on.
+		 */
+		void set_pressed(bool pressed);
+
+		/** Returns whether B is pressed on the emulated controller. */
+		bool pressed() const
+		{
+			return pressed_;
+		}
+
+		/** Returns when B last changed, from time_us_32(), never 0. */
+		uint32_t changed_us() const
+		{
+			return changed_us_;
+		}
+
+	private:
+		std::atomic_bool active_ = false;
+		std::atomic_bool pressed_ = false;
+		std::atomic<uint32_t> changed_us_ = 1;
+		int sm_ = -1;
+		uint offset_ = 0;
+	};
+
+	extern loopback_tester loopback;
+}
+
+#endif//SCTU_LOOPBACK_H_
@@ -6,15 +6,52 @@
 #define SCTU_PIO_CONTROLLER_H_
 
 #include <sctu/controller.h>
+#include <sctu/filter.h>
+#include <sctu/latency.h>
 #include <controllers.pio.h>
 
 #include <hardware/pio.h>
+#include <pico/time.h>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <array>
+#include <atomic>
 #include <cstdint>
 
 namespace sctu
 {
-	/** Manages the 4 controller hub implemented over PIO.
+	/** Pins used by the controller hub.
+	 */
+	struct pin_map
+	{
+		/// Clock, shared by every port.
+		uint clk;
+		/// Latch, shared by every port.
+		uint latch;
+		/// DATA0 pin of every port, its DATA1 pin must be the next one.
+		std::array<uint, port_count> data;
+	};
+
+	/** Manages the controller hub implemented over PIO.
+	 *
+	 * Every port has its own state machine. The first 4 ports are on pio0,
+	 * where the first state machine drives CLK and LATCH and starts the
+	 * others with an irq. Ports past the fourth are on pio1, which can't see
+	 * pio0's irqs, so its state machines follow LATCH instead.
+	 *
+	 * Each state machine pushes one 32 bit word per sample into its RX FIFO.
+	 * A chain of DMA channels, one per state machine, moves those words
+	 * into a buffer, and the last channel in the chain raises an interrupt
+	 * that wakes up the task waiting for the sample. Each word carries both
+	 * the DATA0 and DATA1 streams of its port, so with multitap style devices
+	 * attached the hub reports up to max_players players.
+	 *
+	 * The buffer is double-buffered: the DMA chain always fills the back
+	 * buffer, and the interrupt handler publishes it once complete. This lets
+	 * the hub free-run in autopoll mode while readers grab the newest sample
+	 * without waiting on the bus.
 	 */
 	class pio_controllers
 	{
@@ -28,69 +65,203 @@ namespace sctu
 
 		/** Constructor.
 		 *
-		 * Initializes the given PIO with the necessary programs and starts
-		 * them to control the 4 SNES controller hub.
+		 * Initializes the PIO blocks with the necessary programs and starts
+		 * them to control the SNES controller hub. This also claims the DMA
+		 * channels used to collect samples, and installs the DMA interrupt
+		 * handler on the calling core.
 		 *
-		 * @param[in,out] pio PIO instance to program and control.
+		 * Only one instance may exist at a time.
+		 *
+		 * @param[in] pins Pins of the hub.
 		 */
-		explicit pio_controllers(PIO pio)
-		:pio_(pio)
-		{
-			uint offset0 = pio_add_program(pio_, &controller0_program);
-			uint offset1 = pio_add_program(pio_, &controllers1_3_program);
+		explicit pio_controllers(const pin_map& pins);
 
-			pio_controllers_init(pio_, offset0, offset1, 0, 100.0);
-		}
+		/** Destructor.
+		 *
+		 * Releases the DMA channels and the interrupt handler.
+		 */
+		~pio_controllers();
 
 		/** Poll the SNES controller hub.
 		 *
-		 * @returns The current state of the hub, one state per controller.
+		 * This starts a sample and blocks the calling task until the DMA
+		 * chain signals that all 4 words have landed. In autopoll mode no
+		 * sample is started, this just waits for the next one. If no sample
+		 * arrives in time (e.g. a state machine stalled), the previous state
+		 * is returned instead.
+		 *
+		 * @param[out] times If not null, set to the times of the returned
+		 *  sample.
+		 *
+		 * @returns The current state of the hub, one state per player.
+		 */
+		std::array<controller, max_players> poll(sample_times *times = nullptr);
+
+		/** Starts a sample without waiting for it.
+		 *
+		 * This is safe to call from an interrupt. It does nothing in autopoll
+		 * mode, as the hub is already sampling on its own.
+		 */
+		void start();
+
+		/** Waits for the next sample to land, without starting one.
+		 *
+		 * A sample that landed since the last poll() or wait() returns
+		 * immediately.
+		 *
+		 * @param[in] timeout Maximum number of ticks to wait.
+		 *
+		 * @returns True if a sample landed, false on a timeout.
+		 */
+		bool wait(TickType_t timeout);
+
+		/** Returns the newest complete sample without blocking.
+		 *
+		 * This is safe to call from any task.
+		 *
+		 * @param[out] times If not null, set to the times of the returned
+		 *  sample, only the trigger and ready times are filled in.
+		 *
+		 * @returns The latest state of the hub, one state per player.
+		 */
+		std::array<controller, max_players> latest(
+			sample_times *times = nullptr) const;
+
+		/** Returns the newest complete sample, before decoding.
+		 *
+		 * This is safe to call from any task.
+		 *
+		 * @param[out] times If not null, set to the times of the returned
+		 *  sample, only the trigger and ready times are filled in.
+		 *
+		 * @returns The raw interleaved DATA0/DATA1 word of every port.
+		 */
+		std::array<uint32_t, port_count> latest_raw(
+			sample_times *times = nullptr) const;
+
+		/** Starts sampling the hub continuously.
+		 *
+		 * A repeating timer re-latches the controllers at the given rate, and
+		 * every sample is published as soon as it lands. Rates too fast for
+		 * the default bus timing switch the state machines to the console's
+		 * own (twice as fast) clock.
+		 *
+		 * @param[in] rate_hz Sample rate, clamped to [min_autopoll_hz,
+		 *  max_autopoll_hz].
 		 */
-		std::array<controller, 4> poll()
+		void start_autopoll(unsigned rate_hz);
+
+		/** Stops continuous sampling and returns to on-demand sampling.
+		 *
+		 * This blocks for a couple of ticks to let an in-flight sample drain.
+		 */
+		void stop_autopoll();
+
+		/** Sets the glitch filter window.
+		 *
+		 * Every published sample becomes the bitwise majority of the last
+		 * samples words taken from the bus, see sample_filter. The window is
+		 * applied from the next sample on.
+		 *
+		 * @param[in] samples Window in samples, rounded down to an odd number
+		 *  and clamped to [1, max_filter_samples]. 1 disables filtering.
+		 */
+		void set_filter(unsigned samples);
+
+		/** Restarts every state machine and the DMA chain.
+		 *
+		 * This is the way out of a stalled state machine, for the watchdog
+		 * to call from another task while the sampling task is stuck. Each
+		 * state machine goes back to the start of its program with empty
+		 * FIFOs and LATCH released, a sample in flight is lost, and a task
+		 * waiting on one is woken up to try again.
+		 */
+		void recover();
+
+		/** Returns the glitch filter window, in samples. */
+		unsigned filter() const
+		{
+			return filter_.window();
+		}
+
+		/** Returns whether the hub is currently free-running. */
+		bool autopolling() const
 		{
-			pio_sm_put(pio_, 0, 0);
-			vTaskDelay(1); // FIXME is there a better way to block
-						   // intelligently?
-
-			std::array<controller, 4> result;
-			for (size_t i = 0; i < 4; ++i)
-			{
-				uint32_t data = pio_sm_get(pio_, i);
-				// Order:
-				// B Y SELECT START UP DOWN LEFT RIGHT A X L R ^ ^ ^ ^
-				// a low value signals that the button is pressed!
-				result[i] = controller {
-					.connected =
-						((data >> 24) & 1) &&
-						((data >> 26) & 1) &&
-						((data >> 28) & 1) &&
-						((data >> 30) & 1)
-					,
-					.x = static_cast<int8_t>(
-						!(data & (1 << 12)) ? -127 :
-						!(data & (1 << 14)) ?  127 : 0
-					),
-					.y = static_cast<int8_t>(
-						!(data & (1 <<  8)) ? -127 :
-						!(data & (1 << 10)) ?  127 : 0
-					),
-					.buttons = static_cast<uint8_t>(
-						(!((data >>  0) & 1)) << 0 |
-						(!((data >>  2) & 1)) << 1 |
-						(!((data >>  4) & 1)) << 2 |
-						(!((data >>  6) & 1)) << 3 |
-						(!((data >> 16) & 1)) << 4 |
-						(!((data >> 18) & 1)) << 5 |
-						(!((data >> 20) & 1)) << 6 |
-						(!((data >> 22) & 1)) << 7
-					),
-				};
-			}
-
-			return result;
+			return autopoll_;
 		}
+
+		/// Slowest supported autopoll rate.
+		static constexpr unsigned min_autopoll_hz = 100;
+		/// Fastest supported autopoll rate.
+		static constexpr unsigned max_autopoll_hz = 4000;
+
 	private:
-		PIO pio_;
+		/** Arms the DMA chain so it collects the next sample. */
+		void arm();
+
+		/** Points the DMA chain at the given buffer. */
+		void retarget(size_t buffer);
+
+		/** Sets the clock divider of all state machines, keeping them in
+		 * phase. */
+		void set_clock_divider(float divider);
+
+		/** Queues a sample request if the primary state machine does not
+		 * already have one pending. Safe to call from an interrupt. */
+		void trigger();
+
+		/** Repeating timer callback used in autopoll mode. */
+		static bool autopoll_callback(repeating_timer_t *timer);
+
+		/** Stops the DMA chain and flushes the state machine FIFOs. */
+		void reset();
+
+		/** Returns the PIO block driving the given port. */
+		static PIO block(size_t port)
+		{
+			return port < ports_per_block ? pio0 : pio1;
+		}
+
+		/** Returns the mask of the state machines used in the given block. */
+		static uint32_t block_mask(PIO pio);
+
+		/** Returns the state machine driving the given port. */
+		static uint state_machine(size_t port)
+		{
+			return port % ports_per_block;
+		}
+
+		/// Each PIO block has 4 state machines.
+		static constexpr size_t ports_per_block = 4;
+
+		/** DMA interrupt handler, wakes up the listening task. */
+		static void dma_handler();
+
+		std::array<uint, port_count> dma_channels_;
+		/// Where each program was loaded, to restart the state machines
+		/// from.
+		uint primary_offset_;
+		uint secondary_offset_;
+		uint follower_offset_ = 0;
+		std::array<std::array<uint32_t, port_count>, 2> raw_ = {};
+		/// Times of the sample in each buffer, published along with it.
+		std::array<sample_times, 2> times_ = {};
+		/// When the newest sample request was queued. A request queued while
+		/// a sample is in flight makes that sample look younger than it is,
+		/// by at most one sample.
+		std::atomic<uint32_t> trigger_us_ = 0;
+		/// Incremented on every published sample, its lowest bit is the
+		/// index of the front buffer.
+		std::atomic<uint32_t> sequence_ = 0;
+		/// Task notified of every sample, set by poll() and wait().
+		std::atomic<TaskHandle_t> listener_ = nullptr;
+		std::atomic_bool autopoll_ = false;
+		repeating_timer_t timer_ = {};
+
+		/// Only applied from the DMA interrupt handler.
+		sample_filter filter_;
+
+		static pio_controllers* instance_;
 	};
 }
 
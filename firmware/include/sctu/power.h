@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_POWER_H_
+#define SCTU_POWER_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	/** Clock management, to draw as little as possible while the USB bus is
+	 * suspended.
+	 *
+	 * At boot the clocks of blocks the firmware never uses are stopped. In
+	 * low power mode the system and peripheral clocks run from the 48 MHz
+	 * USB PLL instead of the system PLL, which is stopped, and the tick is
+	 * retuned so FreeRTOS timing doesn't change. USB keeps its own clock, so
+	 * the bus can still be resumed either way.
+	 */
+	class power_manager
+	{
+	public:
+		/** Low power statistics since boot. */
+		struct stats
+		{
+			/// Times low power mode was entered.
+			uint32_t suspends;
+			/// Time spent in low power mode, in ms, counting the current
+			/// stay.
+			uint32_t low_power_ms;
+		};
+
+		/** Stops the clocks of unused blocks, and records the system clock
+		 * to come back to. Must be called once, from the init task. */
+		void initialize();
+
+		/** Slows the clocks down.
+		 *
+		 * Must be called from a task, which briefly runs on every core to
+		 * retune their tick. Only one task may change modes.
+		 */
+		void enter_low_power();
+
+		/** Brings the clocks back to full speed. Same rules as
+		 * enter_low_power(). */
+		void exit_low_power();
+
+		/** Returns whether low power mode is on. */
+		bool low_power() const
+		{
+			return low_power_;
+		}
+
+		/** Returns the statistics of low power mode. */
+		stats get_stats() const;
+
+	private:
+		/** Reloads the tick timer of every core for the current clk_sys. */
+		static void retune_ticks();
+
+		uint32_t full_speed_khz_ = 0;
+		std::atomic_bool low_power_ = false;
+		std::atomic<uint32_t> suspends_ = 0;
+		/// Totals in ms, so they stay atomic on the M0+ and still last 49
+		/// days.
+		std::atomic<uint32_t> low_power_ms_ = 0;
+		std::atomic<uint32_t> entered_ms_ = 0;
+	};
+
+	extern power_manager power;
+}
+
+#endif//SCTU_POWER_H_
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_REPORT_H_
+#define SCTU_REPORT_H_
+
+#include <sctu/controller.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace sctu
+{
+	/// Size of a controller's HID report, without the report ID.
+	constexpr const size_t report_size = 3;
+
+	/** HID report of a controller: X, Y, then the buttons. */
+	using hid_report = std::array<uint8_t, report_size>;
+
+	/** Builds the HID report of a controller state.
+	 *
+	 * A disconnected controller reports a neutral state.
+	 */
+	constexpr hid_report make_report(const controller& state)
+	{
+		// Our report only has 3 bytes, don't assume the struct with the data
+		// has no padding, and don't use the no padding directive for
+		// structs-- last thing I want to deal with is misaligned data access
+		// on ARM.
+		if (!state.connected)
+			return {};
+		return hid_report {
+			static_cast<uint8_t>(state.x),
+			static_cast<uint8_t>(state.y),
+			state.buttons,
+		};
+	}
+}
+
+#endif//SCTU_REPORT_H_
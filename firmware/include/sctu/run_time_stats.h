@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_RUN_TIME_STATS_H_
+#define SCTU_RUN_TIME_STATS_H_
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sctu
+{
+	/// Number of cores the scheduler runs on.
+	constexpr const size_t run_time_cores = configNUMBER_OF_CORES;
+
+	/** Scheduler counters of a core, kept by the task switch hook.
+	 *
+	 * The counters are 32 bits and wrap, only differences between two reads
+	 * less than an hour apart are meaningful.
+	 */
+	struct core_stats
+	{
+		/// Time spent in an idle task, in us.
+		uint32_t idle_us;
+		/// Number of times a different task was switched in.
+		uint32_t context_switches;
+	};
+
+	/** Returns the counters of a core, up to now.
+	 *
+	 * This is safe to call from any task.
+	 *
+	 * @param[in] core Core to read, must be less than run_time_cores.
+	 */
+	core_stats get_core_stats(size_t core);
+
+	/** Returns the core a task is running on, or last ran on.
+	 *
+	 * @param[in] task Task to look up.
+	 *
+	 * @returns The core number, or -1 if the task never ran.
+	 */
+	int task_core(TaskHandle_t task);
+}
+
+/** Task switch hook, called by the kernel through traceTASK_SWITCHED_IN on
+ * the core that switched, with the kernel locked. See FreeRTOSConfig.h.
+ */
+extern "C" void sctu_task_switched_in(void);
+
+#endif//SCTU_RUN_TIME_STATS_H_
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_SETTINGS_H_
+#define SCTU_SETTINGS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	/// HID report intervals, in ms, that can be selected at runtime.
+	constexpr const std::array<uint8_t, 5> report_intervals_ms { 1, 2, 4, 8, 10 };
+
+	/** Checks whether the given HID report interval is supported.
+	 *
+	 * @param[in] ms Report interval in ms.
+	 *
+	 * @returns True if the interval is one of report_intervals_ms.
+	 */
+	constexpr bool valid_report_interval(unsigned ms)
+	{
+		return std::ranges::find(report_intervals_ms, ms) !=
+			std::end(report_intervals_ms);
+	}
+
+	/** How controllers are exposed over USB as HID interfaces.
+	 */
+	enum class hid_layout : uint8_t
+	{
+		/// Only connected controllers get an interface, plugging or
+		/// unplugging one re-enumerates the device.
+		dynamic,
+		/// All controllers always have an interface, disconnected ones just
+		/// report a neutral state.
+		fixed,
+		/// A single HID interface carries every controller, one report ID
+		/// per controller. Disconnected controllers report a neutral state.
+		combined,
+	};
+
+	/** Runtime tunables shared between tasks.
+	 *
+	 * Every field is atomic, so any task may read or change them. The tasks
+	 * that own the affected hardware pick up changes on their next iteration.
+	 */
+	struct settings
+	{
+		/// Free-running controller sample rate in Hz, or 0 to only sample
+		/// when the HID task asks for it.
+		std::atomic<uint16_t> autopoll_hz = 0;
+
+		/// HID report interval in ms, used both as the endpoint bInterval and
+		/// as the HID task sampling period. Must be one of
+		/// report_intervals_ms.
+		std::atomic<uint8_t> report_interval_ms = 10;
+
+		/// Whether controller latching is scheduled off the USB SOF, instead
+		/// of the HID task's own timer.
+		std::atomic_bool sof_sync = false;
+
+		/// How long before the next report interval boundary, in us, the
+		/// SOF scheduler latches the controllers.
+		std::atomic<uint16_t> sof_lead_us = 500;
+
+		/// HID interface layout presented to the host.
+		std::atomic<hid_layout> layout = hid_layout::dynamic;
+
+		/// Glitch filter window in samples, 1 disables it. The window used
+		/// is reduced until it fits in filter_budget_us.
+		std::atomic<uint8_t> filter_samples = 3;
+
+		/// Maximum latency, in us, the glitch filter may add.
+		std::atomic<uint16_t> filter_budget_us = 1000;
+	};
+
+	extern settings system_settings;
+}
+
+#endif//SCTU_SETTINGS_H_
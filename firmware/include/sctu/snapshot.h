@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_SNAPSHOT_H_
+#define SCTU_SNAPSHOT_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	/** Lock-free single-producer, single-consumer slot holding the newest
+	 * value published.
+	 *
+	 * The producer always writes the back buffer and then publishes it by
+	 * bumping the sequence, whose lowest bit is the index of the front
+	 * buffer. The consumer copies the front buffer and retries if the
+	 * sequence moved while it was copying. Neither side ever blocks, and the
+	 * consumer only ever sees the newest complete value, so this works
+	 * between tasks on different cores as well as from interrupts.
+	 *
+	 * @tparam T Trivially copyable type to hand off.
+	 */
+	template<typename T>
+	class snapshot
+	{
+	public:
+		/** Publishes a new value, replacing the previous one.
+		 *
+		 * Only one task or interrupt may publish.
+		 *
+		 * @param[in] value Value to publish.
+		 */
+		void publish(const T& value)
+		{
+			const uint32_t sequence =
+				sequence_.load(std::memory_order_relaxed) + 1;
+			buffers_[sequence & 1] = value;
+			sequence_.store(sequence, std::memory_order_release);
+		}
+
+		/** Returns the sequence number of the newest value.
+		 *
+		 * It changes every time a value is published, so it can be used to
+		 * check for new values without copying them.
+		 */
+		uint32_t sequence() const
+		{
+			return sequence_.load(std::memory_order_acquire);
+		}
+
+		/** Returns a copy of the newest value.
+		 *
+		 * @param[out] sequence If not null, set to the sequence number of the
+		 *  returned value.
+		 *
+		 * @returns The newest published value, or a value initialized T if
+		 *  nothing has been published yet.
+		 */
+		T read(uint32_t *sequence = nullptr) const
+		{
+			T result;
+			uint32_t current;
+			do
+			{
+				current = sequence_.load(std::memory_order_acquire);
+				result = buffers_[current & 1];
+				std::atomic_thread_fence(std::memory_order_acquire);
+			} while (current != sequence_.load(std::memory_order_relaxed));
+
+			if (sequence)
+				*sequence = current;
+			return result;
+		}
+
+	private:
+		std::array<T, 2> buffers_ = {};
+		std::atomic<uint32_t> sequence_ = 0;
+	};
+}
+
+#endif//SCTU_SNAPSHOT_H_
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_SOF_SCHEDULER_H_
+#define SCTU_SOF_SCHEDULER_H_
+
+#include <sctu/pio_controllers.h>
+
+#include <tusb_config.h>
+
+#include <pico/time.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	/** Phase-locks controller latching to the USB start of frame.
+	 *
+	 * Every report interval the scheduler arms a hardware alarm that latches
+	 * the controllers a configurable lead time before the next interval
+	 * boundary, so a fresh report is already queued when the host's IN token
+	 * arrives. The time each report then waits for the host to pick it up is
+	 * the phase error, tracked so the lead can be tuned per host.
+	 */
+	class sof_scheduler
+	{
+	public:
+		/** Phase error statistics, in us. */
+		struct phase_stats
+		{
+			int32_t min_us;
+			int32_t max_us;
+			int32_t average_us;
+			uint32_t reports;
+		};
+
+		/** Sets the controller hub the scheduler latches.
+		 *
+		 * @param[in] controllers Hub to latch, or nullptr to detach.
+		 */
+		void attach(pio_controllers *controllers);
+
+		/** Enables or disables SOF callbacks to follow the sof_sync setting.
+		 *
+		 * This must be called from the USB task.
+		 */
+		void update();
+
+		/** Handles a start of frame, must be called from the USB task.
+		 *
+		 * @param[in] frame_count Frame number reported by the host.
+		 */
+		void frame(uint32_t frame_count);
+
+		/** Records that a report was handed to TinyUSB.
+		 *
+		 * @param[in] instance HID instance the report was queued on.
+		 */
+		void report_queued(uint8_t instance);
+
+		/** Records that the host picked up a report.
+		 *
+		 * @param[in] instance HID instance the report was sent on.
+		 */
+		void report_complete(uint8_t instance);
+
+		/** Returns the phase error measured since the last reset. */
+		phase_stats stats() const;
+
+		/** Clears the phase error statistics. */
+		void reset_stats();
+
+	private:
+		static int64_t alarm_callback(alarm_id_t id, void *data);
+
+		std::atomic<pio_controllers*> controllers_ = nullptr;
+		bool enabled_ = false;
+		unsigned frames_ = 0;
+
+		/// Time each instance's last report was queued, 0 when none is
+		/// pending.
+		std::array<std::atomic<uint32_t>, CFG_TUD_HID> queued_ = {};
+
+		std::atomic<int32_t> min_ = INT32_MAX;
+		std::atomic<int32_t> max_ = INT32_MIN;
+		std::atomic<int32_t> sum_ = 0;
+		std::atomic<uint32_t> reports_ = 0;
+	};
+
+	extern sof_scheduler sof;
+}
+
+#endif//SCTU_SOF_SCHEDULER_H_
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_STATIC_TASK_H_
+#define SCTU_STATIC_TASK_H_
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <array>
+
+namespace sctu
+{
+	/** Storage for a FreeRTOS task, so it doesn't come from the heap.
+	 *
+	 * Each instance holds the stack and control block of one task, so it must
+	 * outlive the task, which in practice means it should be static.
+	 *
+	 * @tparam stack_depth Size of the stack, in words.
+	 */
+	template<configSTACK_DEPTH_TYPE stack_depth>
+	class static_task
+	{
+	public:
+		/** Creates the task, with the same arguments as
+		 *  xTaskCreateAffinitySet().
+		 *
+		 * This must only be called once per instance, unless the previous
+		 * task was deleted and the idle task had a chance to clean it up.
+		 *
+		 * @returns The handle of the new task.
+		 */
+		TaskHandle_t create(
+			TaskFunction_t function,
+			const char *name,
+			void *parameters,
+			UBaseType_t priority,
+			UBaseType_t affinity)
+		{
+			return xTaskCreateStaticAffinitySet(
+				function,
+				name,
+				stack_depth,
+				parameters,
+				priority,
+				stack_.data(),
+				&tcb_,
+				affinity);
+		}
+
+	private:
+		std::array<StackType_t, stack_depth> stack_;
+		StaticTask_t tcb_;
+	};
+}
+
+#endif//SCTU_STATIC_TASK_H_
@@ -5,54 +5,190 @@
 #ifndef SCTU_SYSLOG_H_
 #define SCTU_SYSLOG_H_
 
-#include <FreeRTOS.h>
-#include <semphr.h>
+#include <sctu/inplace_function.h>
 
-#include <sys/time.h>
+#include <hardware/sync.h>
+#include <pico/platform.h>
+#include <pico/time.h>
 
-#include <deque>
-#include <string_view>
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstddef>
-#include <functional>
-#include <string>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 namespace sctu
 {
+	/** Severity of a log record. */
+	enum class log_level : uint8_t
+	{
+		debug,
+		info,
+		warning,
+		error,
+	};
+
+	/** Returns the name of a log level. */
+	const char* to_string(log_level level);
+
+	/** Formats a binary log record.
+	 *
+	 * Supports the d, i, o, u, x, X, c, s and p conversions with flags, width
+	 * and precision. Length modifiers are accepted and ignored, as every
+	 * argument is stored in one word. Conversions without a matching argument
+	 * are copied as they are.
+	 *
+	 * @param[out] buffer Where to write the text, longer results are
+	 *  truncated.
+	 * @param[in] format printf style format of the record.
+	 * @param[in] arguments Arguments of the record, one word each.
+	 *
+	 * @returns The length of the text written to the buffer.
+	 */
+	size_t format_record(
+		std::span<char> buffer,
+		const char *format,
+		std::span<const uintptr_t> arguments);
+
 	/** System log class.
 	 *
-	 * @tparam max_size The maximum size in bytes of the log in memory.
+	 * Records are kept in a fixed size byte ring, each one a small header
+	 * followed by its payload. Pushing never allocates, and when the ring is
+	 * full the oldest records are dropped to make room.
+	 *
+	 * Records pushed with log() are kept in binary form: the address of their
+	 * format string, and their arguments, one word each. They are only
+	 * formatted when read, so logging costs a few word copies, and a record
+	 * takes a fraction of the RAM its text would. Records pushed with push()
+	 * keep their text instead, for messages built at run time.
+	 *
+	 * The Cortex-M0+ has no exclusive load/store, so there's no real lock-free
+	 * compare and swap. Instead, every access to the ring holds one of the
+	 * RP2040 hardware spinlocks with interrupts disabled, for at most the
+	 * time it takes to copy one record in or out. That makes pushing safe
+	 * from either core and from interrupts, and bounded in time.
+	 *
+	 * Readers keep a cursor, the ring position of the next record to read,
+	 * so they can walk the log without holding the lock between records.
+	 *
+	 * @tparam max_size The size in bytes of the log in memory, must be a power
+	 *  of 2.
 	 */
 	template<size_t max_size>
 	class syslog
 	{
+		static_assert(std::has_single_bit(max_size),
+			"The log size must be a power of 2");
+
 	public:
+		/// Longest text kept, longer ones are truncated.
+		static constexpr size_t max_record_size = 128;
+
+		/// Most arguments a binary record can have.
+		static constexpr size_t max_arguments = 8;
+
+		using argument = uintptr_t;
+
+		/** Header of every record in the ring.
+		 *
+		 * It's followed by the address of the format string, which is null
+		 * for text records, then by the arguments, then by the text.
+		 */
+		struct header
+		{
+			/// Time since boot, in us, when the record was pushed.
+			uint64_t time_us;
+			/// Number of records pushed before this one.
+			uint32_t sequence;
+			/// Size in bytes of the rest of the record.
+			uint16_t length;
+			log_level level;
+			/// Number of arguments.
+			uint8_t arguments;
+		};
+
+		/// Largest record in the ring, header included.
+		static constexpr size_t max_raw_size =
+			sizeof(header) + sizeof(const char*) +
+			std::max(max_arguments * sizeof(argument), max_record_size);
+
+		/** A record read from the log. */
+		struct entry
+		{
+			/// Time since boot, in us, when the record was pushed.
+			uint64_t time_us;
+			/// Number of records pushed before this one, a gap in it means
+			/// records were dropped.
+			uint32_t sequence;
+			log_level level;
+			/// The record, pointing into the caller's buffer.
+			std::string_view text;
+		};
+
+		/** Position of a record in the log, see read(). */
+		using cursor = uint32_t;
+
+		syslog()
+		:lock_(spin_lock_init(spin_lock_claim_unused(true)))
+		{}
+
+		/** Not copyable.
+		 * @{
+		 */
+		syslog(const syslog&) = delete;
+		syslog& operator=(const syslog&) = delete;
+		/** @} */
+
 		/** Add the given string to the log.
 		 *
 		 * If a print callback is registered, this function will forward the
-		 * string to it as well.
+		 * string to it as well, unless called from an interrupt.
 		 *
 		 * @param[in] str String to store in log.
+		 * @param[in] level Severity of the record.
 		 */
-		void push(std::string_view str)
+		void push(std::string_view str, log_level level = log_level::info)
 		{
-			if (str.size() > max_size)
-				return; // FIXME return some kind of error?
-
-			while (logs_.size() && str.size() > space_available_)
-			{
-				space_available_ += logs_.front().record.size();
-				logs_.pop_front();
-			}
+			str = str.substr(0, max_record_size);
+			push_record(level, nullptr, {}, str);
+			notify(str);
+		}
 
-			space_available_ -= str.size();
-			timeval tm;
-			gettimeofday(&tm, nullptr);
-			logs_.emplace_back(std::string(str), std::move(tm));
+		/** Add a binary record to the log.
+		 *
+		 * The format string and any string arguments are stored as pointers,
+		 * so they must live forever, like string literals do. Arguments must
+		 * be at most 32 bit integers, enums or pointers.
+		 *
+		 * If a print callback is registered, it gets the format string,
+		 * unless this is called from an interrupt.
+		 *
+		 * @param[in] level Severity of the record.
+		 * @param[in] format printf style format, see format_record().
+		 * @param[in] args Arguments of the format.
+		 */
+		template<class... Args>
+		void log(log_level level, const char *format, Args... args)
+		{
+			static_assert(sizeof...(Args) <= max_arguments,
+				"Too many arguments for a log record");
+			static_assert(((std::is_integral_v<Args> || std::is_enum_v<Args> ||
+				std::is_pointer_v<Args>) && ...),
+				"Log arguments must be integers, enums or pointers");
+			static_assert(((std::is_pointer_v<Args> ||
+				sizeof(Args) <= sizeof(uint32_t)) && ...),
+				"64 bit log arguments are not supported");
 
-			if (callback_)
-			{
-				callback_(str);
-			}
+			const std::array<argument, sizeof...(Args)> words {
+				to_argument(args)... };
+			push_record(level, format, words, {});
+			notify(format);
 		}
 
 		/** Returns the current number of log lines.
@@ -61,7 +197,7 @@ namespace sctu
 		 */
 		size_t size() const
 		{
-			return logs_.size();
+			return count_;
 		}
 
 		/** Returns the size of the log in bytes.
@@ -70,36 +206,104 @@ namespace sctu
 		 */
 		size_t bytes() const
 		{
-			return max_size - space_available_;
+			const uint32_t save = spin_lock_blocking(lock_);
+			const size_t result = head_ - tail_;
+			spin_unlock(lock_, save);
+			return result;
 		}
 
-		/** Returns the log at the given position.
+		/** Returns a cursor to the oldest record in the log. */
+		cursor begin() const
+		{
+			return tail_;
+		}
+
+		/** Returns a cursor past the newest record in the log. */
+		cursor end() const
+		{
+			return head_;
+		}
+
+		/** Reads the record at the cursor, and moves the cursor past it.
+		 *
+		 * Binary records are formatted here, after the lock is released.
 		 *
-		 * @param[in] index Position of log to get. Must be less than the
-		 *  current size().
+		 * If the record at the cursor was dropped to make room for newer ones,
+		 * this skips ahead to the oldest record still in the log.
 		 *
-		 * @returns The log at the requested position.
+		 * @param[in,out] position Cursor to read from.
+		 * @param[out] buffer Buffer the text is written to, longer records are
+		 *  truncated.
+		 *
+		 * @returns The record, or nothing if there are no more records.
 		 */
-		std::string operator[](size_t index) const
-		{
-			auto& log = logs_[index];
-			std::string decimal = std::to_string(log.time.tv_usec);
-			// Build a string of the form of:
-			// [seconds].[decimals, 6 digits] - [log  contents]
-			return std::to_string(log.time.tv_sec) + "." +
-				std::string(6u - std::min(6u, decimal.length()), '0') +
-				decimal + " - " + log.record;
+		std::optional<entry> read(cursor& position, std::span<char> buffer) const
+		{
+			const uint32_t save = spin_lock_blocking(lock_);
+			if (!seek(position))
+			{
+				spin_unlock(lock_, save);
+				return std::nullopt;
+			}
+
+			header head;
+			const char *format;
+			std::array<argument, max_arguments> args;
+			uint32_t next = copy_out(position, &head, sizeof(head));
+			next = copy_out(next, &format, sizeof(format));
+			const size_t args_size = head.arguments * sizeof(argument);
+			next = copy_out(next, args.data(), args_size);
+			size_t length = std::min<size_t>(
+				head.length - sizeof(format) - args_size, buffer.size());
+			copy_out(next, buffer.data(), format ? 0 : length);
+			position += sizeof(head) + head.length;
+			spin_unlock(lock_, save);
+
+			if (format)
+			{
+				length = format_record(
+					buffer, format, std::span(args.data(), head.arguments));
+			}
+			return entry {
+				.time_us = head.time_us,
+				.sequence = head.sequence,
+				.level = head.level,
+				.text = std::string_view(buffer.data(), length),
+			};
 		}
 
-		/** Returns the last log inserted.
+		/** Copies the record at the cursor as it is in the ring, and moves the
+		 *  cursor past it.
 		 *
-		 * The log must have at least one element.
+		 * This is the header, followed by the rest of the record, in the
+		 * firmware's byte order and pointer size. Like read(), this skips
+		 * records that were dropped.
 		 *
-		 * @returns The last log inserted.
+		 * @param[in,out] position Cursor to read from.
+		 * @param[out] buffer Buffer to copy the record to, should hold
+		 *  max_raw_size bytes, longer records are truncated.
+		 *
+		 * @returns The part of the buffer holding the record, or nothing if
+		 *  there are no more records.
 		 */
-		std::string_view back() const
+		std::optional<std::span<uint8_t>> read_raw(
+			cursor& position, std::span<uint8_t> buffer) const
 		{
-			return logs_.back();
+			const uint32_t save = spin_lock_blocking(lock_);
+			if (!seek(position))
+			{
+				spin_unlock(lock_, save);
+				return std::nullopt;
+			}
+
+			header head;
+			copy_out(position, &head, sizeof(head));
+			const size_t length =
+				std::min(sizeof(head) + head.length, buffer.size());
+			copy_out(position, buffer.data(), length);
+			position += sizeof(head) + head.length;
+			spin_unlock(lock_, save);
+			return buffer.first(length);
 		}
 
 		/** Registers a callback function that is called every time a log entry
@@ -108,6 +312,8 @@ namespace sctu
 		 * @tparam Func Function or functor type of the callback. Must be a
 		 *  function that takes a string_view as its final argument. All other
 		 *  arguments will be passed every invocation.
+		 *  The function and arguments are stored without allocating, so they
+		 *  must be trivially copyable, and small, see inplace_function.
 		 * @tparam Args Argument types of the function or functor.
 		 *
 		 * @param[in] func Function or functor to register with the log.
@@ -117,88 +323,113 @@ namespace sctu
 		template<class Func, class... Args>
 		void register_push_callback(Func&& func, Args&&... args)
 		{
-			auto wrapper = [func, ... args = std::forward<Args>(args)](std::string_view str)
+			auto wrapper = [func = std::decay_t<Func>(std::forward<Func>(func)),
+				... args = std::forward<Args>(args)](std::string_view str)
 			{
-				func(std::forward<Args>(args)..., str);
+				func(args..., str);
 			};
 			callback_ = wrapper;
 		}
 
 	private:
-		struct log {
-			std::string record;
-			timeval time;
-		};
-		size_t space_available_ = max_size;
-		std::deque<log> logs_;
-		std::function<void(std::string_view)> callback_;
-	};
-
-	/** Wrapper around syslog to make it thread-safe.
-	 *
-	 * Uses a FreeRTOS mutex to limit access to one task at a time.
-	 */
-	template<class syslog>
-	class safe_syslog
-	{
-	public:
-		safe_syslog()
+		template<class T>
+		static argument to_argument(T value)
 		{
-			mutex_ = xSemaphoreCreateBinaryStatic(&mutex_buffer_);
-			xSemaphoreGive(mutex_);
+			if constexpr (std::is_pointer_v<T>)
+				return reinterpret_cast<argument>(value);
+			else if constexpr (std::is_enum_v<T>)
+				return static_cast<argument>(std::to_underlying(value));
+			else
+				return static_cast<argument>(value);
 		}
 
-		void push(std::string_view&& str)
+		void push_record(
+			log_level level,
+			const char *format,
+			std::span<const argument> args,
+			std::string_view text)
 		{
-			xSemaphoreTake(mutex_, portMAX_DELAY);
-			log_.push(str);
-			xSemaphoreGive(mutex_);
-		}
+			header head {
+				.time_us = time_us_64(),
+				.sequence = 0,
+				.length = static_cast<uint16_t>(
+					sizeof(format) + args.size_bytes() + text.size()),
+				.level = level,
+				.arguments = static_cast<uint8_t>(args.size()),
+			};
+			const uint32_t needed = sizeof(head) + head.length;
 
-		size_t size() const
-		{
-			xSemaphoreTake(mutex_, portMAX_DELAY);
-			size_t result = log_.size();
-			xSemaphoreGive(mutex_);
-			return result;
+			const uint32_t save = spin_lock_blocking(lock_);
+			head.sequence = pushed_++;
+			while (head_ - tail_ + needed > max_size)
+			{
+				header oldest;
+				copy_out(tail_, &oldest, sizeof(oldest));
+				tail_ += sizeof(oldest) + oldest.length;
+				--count_;
+			}
+			uint32_t next = copy_in(head_, &head, sizeof(head));
+			next = copy_in(next, &format, sizeof(format));
+			next = copy_in(next, args.data(), args.size_bytes());
+			copy_in(next, text.data(), text.size());
+			head_ += needed;
+			++count_;
+			spin_unlock(lock_, save);
 		}
 
-		size_t bytes() const
+		void notify(std::string_view str)
 		{
-			xSemaphoreTake(mutex_, portMAX_DELAY);
-			size_t result = log_.bytes_();
-			xSemaphoreGive(mutex_);
-			return result;
+			// The callback is free to block, so it can't run in an interrupt
+			if (callback_ && !__get_current_exception())
+			{
+				callback_(str);
+			}
 		}
 
-		std::string operator[](size_t index) const
+		/** Moves a cursor to a record still in the log, must hold the lock.
+		 *
+		 * @returns False if there's no record at the cursor.
+		 */
+		bool seek(cursor& position) const
 		{
-			xSemaphoreTake(mutex_, portMAX_DELAY);
-			std::string result = std::string(log_[index]);
-			xSemaphoreGive(mutex_);
-			return result;
+			if (static_cast<int32_t>(position - tail_) < 0)
+				position = tail_;
+			return position != head_;
 		}
 
-		std::string back() const
+		uint32_t copy_in(uint32_t position, const void *data, size_t size)
 		{
-			xSemaphoreTake(mutex_, portMAX_DELAY);
-			std::string result = log_.back();
-			xSemaphoreGive(mutex_);
-			return result;
+			if (!size)
+				return position;
+			const size_t offset = position & (max_size - 1);
+			const size_t first = std::min(size, max_size - offset);
+			const uint8_t *bytes = static_cast<const uint8_t*>(data);
+			std::memcpy(ring_.data() + offset, bytes, first);
+			std::memcpy(ring_.data(), bytes + first, size - first);
+			return position + size;
 		}
 
-		template<class Func, class... Args>
-		void register_push_callback(Func&& func, Args&&... args)
+		uint32_t copy_out(uint32_t position, void *data, size_t size) const
 		{
-			xSemaphoreTake(mutex_, portMAX_DELAY);
-			log_.register_push_callback(std::forward<Func>(func), std::forward<Args>(args)...);
-			xSemaphoreGive(mutex_);
+			if (!size)
+				return position;
+			const size_t offset = position & (max_size - 1);
+			const size_t first = std::min(size, max_size - offset);
+			uint8_t *bytes = static_cast<uint8_t*>(data);
+			std::memcpy(bytes, ring_.data() + offset, first);
+			std::memcpy(bytes + first, ring_.data(), size - first);
+			return position + size;
 		}
 
-	private:
-		syslog log_;
-		StaticSemaphore_t mutex_buffer_;
-		SemaphoreHandle_t mutex_;
+		std::array<uint8_t, max_size> ring_ = {};
+		/// Ring positions of the next record to write, and of the oldest
+		/// record. They only ever grow, wrapping around at 2^32.
+		uint32_t head_ = 0;
+		uint32_t tail_ = 0;
+		size_t count_ = 0;
+		uint32_t pushed_ = 0;
+		spin_lock_t *lock_;
+		inplace_function<void(std::string_view)> callback_;
 	};
 }
 
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#ifndef SCTU_TASK_PRIORITIES_H_
+#define SCTU_TASK_PRIORITIES_H_
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+namespace sctu
+{
+	// Every task in the firmware gets its priority from here, so the whole
+	// scheme can be seen at once. The latency critical tasks are at the top,
+	// and as they block on events, everything else runs in their idle time.
+	// The watchdog sits below them on purpose: if one of them ever stops
+	// blocking, the watchdog starves and the system resets.
+
+	/// Initialization, the CLI, re-enumeration, and the log drain, none of
+	/// which are time sensitive.
+	constexpr const UBaseType_t background_task_priority = tskIDLE_PRIORITY + 1;
+
+	/// Per-core watchdog tasks.
+	constexpr const UBaseType_t watchdog_task_priority = tskIDLE_PRIORITY + 2;
+
+	/// Controller sampling, runs once per report interval.
+	constexpr const UBaseType_t controller_task_priority = tskIDLE_PRIORITY + 3;
+
+	/// USB task, blocks on TinyUSB's event queue and must service it as soon
+	/// as possible.
+	constexpr const UBaseType_t usb_task_priority = tskIDLE_PRIORITY + 4;
+
+	/// Tasks holding a core out of XIP while the other one writes to flash,
+	/// above everything, as nothing else may run from flash meanwhile.
+	constexpr const UBaseType_t flash_lockout_task_priority =
+		configMAX_PRIORITIES - 1;
+}
+
+#endif//SCTU_TASK_PRIORITIES_H_
@@ -5,8 +5,96 @@
 #ifndef SCTU_USB_H_
 #define SCTU_USB_H_
 
+#include <sctu/settings.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
 #include <cstdint>
 
+/** Re-enumeration statistics. */
+struct usb_reenumeration_stats
+{
+	/// Number of changes that needed a re-enumeration.
+	uint32_t requests;
+	/// Number of re-enumerations actually done.
+	uint32_t reenumerations;
+	/// Number of requests coalesced into another re-enumeration, or dropped
+	/// because the change was undone within the settle window.
+	uint32_t suppressed;
+};
+
+/** Starts the task that re-enumerates the device on configuration changes.
+ *
+ * Changes that need a re-enumeration are coalesced by this task: it waits
+ * until no new change arrives for a settle window, and only then reconnects
+ * once, and only if the configuration is actually different to what the host
+ * has. None of the functions requesting changes block.
+ *
+ * This _must_ be called from within a FreeRTOS task, before starting the USB
+ * task!
+ */
+void usb_initialize_reenumeration_task();
+
+/** Initializes TinyUSB.
+ *
+ * Waits for the controller task to report the controllers connected at boot,
+ * see usb_set_probed_controllers(), so the first configuration descriptor
+ * already has them.
+ *
+ * This must be called from the USB task, before anything else in it.
+ */
+void usb_initialize();
+
+/** Sets the controllers connected at boot, and lets usb_initialize() go on.
+ *
+ * This must be called once, from the controller task, before it enables or
+ * disables any controller.
+ *
+ * @param[in] controllers Bitmask of connected controllers, see
+ *  usb_get_active_controllers().
+ */
+void usb_set_probed_controllers(uint8_t controllers);
+
+/** Returns whether the host has suspended the bus.
+ *
+ * It is safe to call this from threads other than the USB one.
+ */
+bool usb_suspended();
+
+/** Sets the task to notify, with xTaskNotifyGive(), whenever the bus is
+ * suspended or resumed.
+ *
+ * @param[in] task Task to notify, or null for none.
+ */
+void usb_set_power_listener(TaskHandle_t task);
+
+/** Builds the serial number string from the board ID, so the string
+ * descriptor callback only has to copy it.
+ *
+ * This must be called before usb_initialize() starts TinyUSB.
+ */
+void usb_prepare_descriptors();
+
+/** Wakes up the USB task if it's waiting for USB events.
+ *
+ * The USB task blocks in tud_task() until there's something to do. Other
+ * tasks call this after changing something the USB task acts on, such as a
+ * new controller sample. Does nothing before usb_initialize().
+ *
+ * This must not be called from an interrupt.
+ */
+void usb_wake();
+
+/** Carries out USB connection changes requested by other tasks.
+ *
+ * TinyUSB is not thread safe, so the re-enumeration task never calls into it
+ * directly, and this does it on its behalf instead.
+ *
+ * This must be called from the USB task.
+ */
+void usb_service();
+
 /** Returns a bitmask describing the number of configured USB HID controllers.
  *
  * It is safe to call this from threads other than the USB one.
@@ -15,12 +103,71 @@
  * bit 1 -> Player 2
  * bit 2 -> Player 3
  * bit 3 -> Player 4
+ * ...
+ * bit 7 -> Player 8 (DATA1 of port 4)
  *
  * @returns A bitmask describing the number of configured controllers.
  */
 uint8_t usb_get_active_controllers();
 
+/** Returns the bitmask of controllers the host currently knows about.
+ *
+ * This may lag usb_get_active_controllers() while a re-enumeration is pending.
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @returns A bitmask of the enumerated controllers, same layout as
+ *  usb_get_active_controllers().
+ */
+uint8_t usb_get_enumerated_controllers();
+
+/** Returns the re-enumeration statistics.
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @returns The re-enumeration statistics since boot.
+ */
+usb_reenumeration_stats usb_get_reenumeration_stats();
+
+/** Returns the HID instance used by the given controller.
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @param[in] controller The index of the controller, starting at 0 (e.g. P1 ==
+ *  0, P2 == 1, etc.).
+ *
+ * @returns The TinyUSB HID instance of the controller, or -1 if the controller
+ *  has no HID interface in the current configuration.
+ */
+int usb_hid_instance(uint8_t controller);
+
+/** Returns the controller that owns the given HID instance.
+ *
+ * This is the inverse of usb_hid_instance().
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @param[in] instance TinyUSB HID instance.
+ *
+ * @returns The index of the controller, starting at 0, or -1 if the instance
+ *  isn't used in the current configuration.
+ */
+int usb_hid_controller(uint8_t instance);
+
+/** Returns the HID report ID used by the given controller.
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @param[in] controller The index of the controller, starting at 0.
+ *
+ * @returns The report ID to send the controller's reports with, 0 if the
+ *  current layout doesn't use report IDs.
+ */
+uint8_t usb_hid_report_id(uint8_t controller);
+
 /** Enables the specified controller's HID interface.
+ *
+ * In the dynamic layout this schedules a re-enumeration.
  *
  * @param[in] The index of the controller to initialize, starting at 0 (e.g.
  *  P1 == 0, P2 == 1, etc.).
@@ -28,10 +175,45 @@ uint8_t usb_get_active_controllers();
 void usb_enable_controller(uint8_t controller);
 
 /** Disables the specified controller's HID interface.
+ *
+ * In the dynamic layout this schedules a re-enumeration.
  *
  * @param[in] The index of the controller to disable, starting at 0 (e.g.
  *  P1 == 0, P2 == 1, etc.).
  */
 void usb_disable_controller(uint8_t controller);
 
+/** Returns the HID report interval currently advertised to the host.
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @returns The endpoint polling interval in ms.
+ */
+uint8_t usb_get_report_interval();
+
+/** Changes the HID report interval advertised to the host.
+ *
+ * As the interval is part of the configuration descriptor, this schedules a
+ * re-enumeration if the interval changes.
+ *
+ * @param[in] ms Endpoint polling interval in ms.
+ */
+void usb_set_report_interval(uint8_t ms);
+
+/** Returns the HID interface layout currently presented to the host.
+ *
+ * It is safe to call this from threads other than the USB one.
+ *
+ * @returns The current HID layout.
+ */
+sctu::hid_layout usb_get_layout();
+
+/** Changes the HID interface layout presented to the host.
+ *
+ * This schedules a re-enumeration if the layout changes.
+ *
+ * @param[in] layout New HID layout.
+ */
+void usb_set_layout(sctu::hid_layout layout);
+
 #endif//SCTU_USB_H_
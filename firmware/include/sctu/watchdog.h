@@ -5,16 +5,128 @@
 #ifndef SCTU_WATCHDOG_H_
 #define SCTU_WATCHDOG_H_
 
+#include <sctu/inplace_function.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
 namespace sctu
 {
-	/** Initializes all of the watchdog tasks for the cores of the machine.
+	/** Heartbeat registry, and the supervisor petting the hardware watchdog
+	 * on its behalf.
 	 *
-	 * For the rp2040, there are two cores, so each core gets its own dedicated
-	 * task, plus one central task.
+	 * Every critical task registers a heartbeat with a deadline, and beats
+	 * it once per loop. A beat later than its deadline counts as a miss. A
+	 * heartbeat that stays silent for twice its deadline is recovered, if
+	 * it has a recovery function, and given another two deadlines for that
+	 * to work. Past that, or right away without a recovery function, the
+	 * supervisor stops petting the hardware watchdog and the board resets.
 	 *
-	 * This _must_ be called from within a FreeRTOS task!
+	 * Only the task owning a heartbeat beats it, so beat() is a couple of
+	 * stores and allocates nothing.
 	 */
-	void initialize_watchdog_tasks();
+	class watchdog_supervisor
+	{
+	public:
+		/// Heartbeats that can be registered.
+		static constexpr const size_t max_heartbeats = 8;
+
+		/** Statistics of one heartbeat since boot. */
+		struct heartbeat_stats
+		{
+			const char *name;
+			uint32_t deadline_us;
+			uint32_t beats;
+			/// Beats later than the deadline, counting a current one.
+			uint32_t misses;
+			/// Longest time between beats, counting the current one.
+			uint32_t worst_us;
+			uint32_t recoveries;
+		};
+
+		/** Registers a heartbeat.
+		 *
+		 * Supervision starts on its first beat(), so tasks can register
+		 * before a long initialization. Safe to call from any task.
+		 *
+		 * @param[in] name Name of the heartbeat, must outlive it.
+		 * @param[in] deadline_us Longest time allowed between beats.
+		 * @param[in] recover Called from the supervisor to unstick the task,
+		 *  or empty to reset the board instead.
+		 *
+		 * @returns The ID of the heartbeat, or -1 if there's no room left.
+		 */
+		int add(const char *name, uint32_t deadline_us,
+			inplace_function<void()> recover = {});
+
+		/** Records that the task owning a heartbeat is alive.
+		 *
+		 * Must only be called from that task.
+		 */
+		void beat(int id);
+
+		/** Changes the deadline of a heartbeat, e.g. when its period
+		 * changes. Takes effect from the next beat. */
+		void set_deadline(int id, uint32_t deadline_us);
+
+		/** Returns the number of heartbeats registered. */
+		size_t size() const
+		{
+			return ready_;
+		}
+
+		/** Returns the statistics of a heartbeat. */
+		heartbeat_stats get_stats(size_t id) const;
+
+		/** Returns the heartbeat that got the board reset on the previous
+		 * boot, or -1 if it wasn't reset by a heartbeat. Heartbeats are
+		 * registered in the same order on every boot, so this can be
+		 * passed to get_stats() for the name. */
+		int reset_heartbeat() const
+		{
+			return reset_heartbeat_;
+		}
+
+		/** Starts the supervisor task, along with a task on every core
+		 * beating its own heartbeat, so a core that stops scheduling is
+		 * caught too.
+		 *
+		 * This _must_ be called from within a FreeRTOS task!
+		 */
+		void initialize_tasks();
+
+	private:
+		struct heartbeat
+		{
+			const char *name = nullptr;
+			inplace_function<void()> recover;
+			std::atomic<uint32_t> deadline_us = 0;
+			std::atomic<uint32_t> last_us = 0;
+			/// Written only by the owning task.
+			std::atomic<uint32_t> beats = 0;
+			std::atomic<uint32_t> misses = 0;
+			std::atomic<uint32_t> worst_us = 0;
+			/// Written only by the supervisor.
+			std::atomic<uint32_t> recoveries = 0;
+			uint32_t recovered_beat = 0;
+		};
+
+		static void supervisor_task(void *self);
+
+		/** Checks every heartbeat once, returns false if the board must be
+		 * reset. */
+		bool check(uint32_t now_us, uint32_t resumed_us);
+
+		std::array<heartbeat, max_heartbeats> heartbeats_;
+		/// Slots handed out by add(), and slots fully set up.
+		std::atomic<size_t> reserved_ = 0;
+		std::atomic<size_t> ready_ = 0;
+		int reset_heartbeat_ = -1;
+	};
+
+	extern watchdog_supervisor supervisor;
 }
 
 #endif//SCTU_WATCHDOG_H_
@@ -59,9 +59,11 @@
   #error "Incorrect RHPort configuration"
 #endif
 
-// This examples use FreeRTOS
-// FIXME apparently this is inserted by the pico-sdk
-//#define CFG_TUSB_OS               OPT_OS_FREERTOS
+// The pico-sdk defines CFG_TUSB_OS as OPT_OS_PICO on the command line, which
+// makes tud_task() poll. Use the FreeRTOS abstraction instead, so tud_task()
+// blocks on its event queue and the USB task only runs when there's work.
+#undef CFG_TUSB_OS
+#define CFG_TUSB_OS               OPT_OS_FREERTOS
 
 #ifndef CFG_TUSB_DEBUG
 #define CFG_TUSB_DEBUG           0
@@ -91,7 +93,7 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID               4
+#define CFG_TUD_HID               8
 #define CFG_TUD_CDC               1
 #define CFG_TUD_MSC               0
 #define CFG_TUD_MIDI              0
@@ -102,7 +104,8 @@
 
 // CDC FIFO size of TX and RX
 #define CFG_TUD_CDC_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
-#define CFG_TUD_CDC_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
+// A few packets of TX, so the USB task can keep the endpoint busy
+#define CFG_TUD_CDC_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 256)
 
 // CDC Endpoint transfer buffer size, more is faster
 #define CFG_TUD_CDC_EP_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
@@ -5,6 +5,8 @@
 #include <FreeRTOS.h>
 #include <semphr.h>
 
+#include <hardware/sync.h>
+
 extern "C"
 {
 	void vApplicationGetIdleTaskMemory(StaticTask_t **idle_task_tcb, StackType_t **idle_task_stack, uint32_t *idle_stack_size)
@@ -37,6 +39,24 @@ extern "C"
 		*timer_stack_size = sizeof(task_stack)/sizeof(*task_stack);
 	}
 
+	// Idle cores wait for the next interrupt, be it the tick, the other core
+	// asking for a yield, or a peripheral, instead of spinning. With the
+	// clocks slowed down in low power mode this is most of the saving.
+	void vApplicationIdleHook()
+	{
+		__wfi();
+	}
+
+	void vApplicationPassiveIdleHook()
+	{
+		__wfi();
+	}
+
+	void vApplicationMallocFailedHook()
+	{
+		__asm volatile ("bkpt #0");
+	}
+
 	void vApplicationStackOverflowHook(
 		TaskHandle_t /*xTask*/, char * /*pcTaskName*/)
 	{
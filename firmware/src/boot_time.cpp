@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/boot_time.h>
+
+#include <pico/time.h>
+
+#include <array>
+#include <cstdint>
+
+namespace sctu
+{
+	const char* to_string(boot_stage stage)
+	{
+		constexpr const std::array<const char*, boot_stage_count> names {
+			"init task",
+			"mpu ready",
+			"settings loaded",
+			"controllers probed",
+			"usb started",
+			"host request",
+			"mounted",
+			"first report",
+		};
+		const size_t index = static_cast<size_t>(stage);
+		return index < names.size() ? names[index] : "unknown";
+	}
+
+	void boot_timeline::mark(boot_stage stage)
+	{
+		// The timer starts at 0 on reset, and a boot never gets anywhere in
+		// under a us, so 0 can mean not reached yet
+		uint32_t expected = 0;
+		times_[static_cast<size_t>(stage)].compare_exchange_strong(
+			expected, time_us_32(), std::memory_order_relaxed);
+	}
+
+	boot_timeline boot_times;
+}
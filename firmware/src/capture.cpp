@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/capture.h>
+#include <sctu/cdc_device.h>
+#include <sctu/static_task.h>
+#include <sctu/task_priorities.h>
+
+#include <pico/time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace sctu
+{
+	// The ring holds 64 ms of samples at the fastest autopoll rate, the task
+	// only needs to empty it a few times within that
+	constexpr const TickType_t capture_period = pdMS_TO_TICKS(5);
+
+	// Writes that made no progress before a frame is given up, see
+	// log_drain::write_cdc
+	constexpr const int cdc_retries = 10;
+
+	static static_task<configMINIMAL_STACK_SIZE> capture_task;
+
+	void capture_stream::initialize_task()
+	{
+		// Same core as the CLI and the log drain, they all share CDC
+		handle_ = capture_task.create(
+			task,
+			"sctu_capture",
+			this,
+			background_task_priority,
+			1 << 0);
+	}
+
+	void capture_stream::start()
+	{
+		active_ = true;
+		xTaskNotifyGive(handle_);
+	}
+
+	void capture_stream::stop()
+	{
+		active_ = false;
+	}
+
+	void capture_stream::record(
+		uint32_t time_us, std::span<const uint32_t, port_count> raw)
+	{
+		capture_record record;
+		record.time_us = time_us;
+		std::copy(raw.begin(), raw.end(), record.raw.begin());
+		if (!ring_.push(record))
+			overflows_.store(overflows_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+	}
+
+	capture_stream::stats capture_stream::get_stats() const
+	{
+		return stats {
+			.records = records_,
+			.dropped = dropped_,
+		};
+	}
+
+	void capture_stream::task(void* capture)
+	{
+		capture_stream& self = *reinterpret_cast<capture_stream*>(capture);
+		for (;;)
+		{
+			// Sleep until capturing starts, then empty the ring regularly
+			if (!self.active_ && !self.ring_.used())
+				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			else
+				vTaskDelay(capture_period);
+			while (self.send_frame());
+		}
+	}
+
+	bool capture_stream::send_frame()
+	{
+		const uint32_t overflows = overflows_.load(std::memory_order_relaxed);
+		const size_t count = std::min(ring_.used(), max_frame_records);
+		if (!count)
+			return false;
+
+		// Dropped records are reported up to what fits in the header, the
+		// rest goes with the next frame
+		const uint32_t missed = std::min<uint32_t>(
+			overflows - reported_overflows_, UINT16_MAX);
+		reported_overflows_ += missed;
+		const capture_frame header {
+			.sync = capture_sync,
+			.ports = static_cast<uint8_t>(port_count),
+			.count = static_cast<uint8_t>(count),
+			.dropped = static_cast<uint16_t>(missed),
+		};
+		std::memcpy(frame_.data(), &header, sizeof(header));
+		size_t length = sizeof(header);
+		for (size_t i = 0; i < count; ++i)
+		{
+			std::memcpy(frame_.data() + length, ring_.peek(),
+				sizeof(capture_record));
+			ring_.pop();
+			length += sizeof(capture_record);
+		}
+		dropped_ += missed;
+
+		// Nobody listening, or a host that stopped reading, loses the rest
+		// of the frame, the host resynchronizes on the next header
+		std::span<const unsigned char> frame(frame_.data(), length);
+		for (int retries = 0; !frame.empty() && retries < cdc_retries;)
+		{
+			const int written = cdc.write(frame);
+			if (written < 0)
+				break;
+			frame = frame.subspan(written);
+			retries = written ? 0 : retries + 1;
+		}
+		if (frame.empty())
+			records_ += count;
+		else
+			dropped_ += count;
+		return count == max_frame_records;
+	}
+
+	bool replay_stream::begin()
+	{
+		if (active_)
+			return false;
+		started_ = false;
+		dry_ = false;
+		records_ = 0;
+		underruns_ = 0;
+		ending_ = false;
+		cancelled_ = false;
+		active_ = true;
+		return true;
+	}
+
+	void replay_stream::feed(const capture_record& record)
+	{
+		// The controller task takes a record every sample, wait for it
+		while (!ring_.push(record))
+			vTaskDelay(1);
+	}
+
+	void replay_stream::end()
+	{
+		ending_ = true;
+	}
+
+	void replay_stream::cancel()
+	{
+		cancelled_ = true;
+		end();
+	}
+
+	bool replay_stream::next(unsigned filter_window, sample_filter::sample& raw)
+	{
+		if (!active_)
+			return false;
+
+		// Only the consumer may pop, so the dropping happens here
+		if (cancelled_)
+		{
+			while (ring_.peek())
+				ring_.pop();
+			active_ = false;
+			return false;
+		}
+
+		const uint32_t now = time_us_32();
+		bool played = false;
+		filter_.set_window(filter_window);
+		while (const capture_record *record = ring_.peek())
+		{
+			// Start timing from the first record, and again after running
+			// dry, so late records don't all play at once
+			if (!started_ || dry_)
+			{
+				if (dry_)
+					++underruns_;
+				started_ = true;
+				dry_ = false;
+				first_record_us_ = record->time_us;
+				start_us_ = now;
+			}
+
+			const uint32_t due = record->time_us - first_record_us_;
+			if (static_cast<int32_t>(due - (now - start_us_)) > 0)
+				break;
+
+			raw = record->raw;
+			filter_.apply(raw);
+			ring_.pop();
+			++records_;
+			played = true;
+		}
+
+		if (!ring_.used())
+		{
+			if (ending_)
+				active_ = false;
+			else if (started_)
+				dry_ = true;
+		}
+		return played;
+	}
+
+	replay_stream::stats replay_stream::get_stats() const
+	{
+		return stats {
+			.records = records_,
+			.underruns = underruns_,
+		};
+	}
+
+	capture_stream capture;
+	replay_stream replay;
+}
@@ -3,9 +3,18 @@
 /// @file
 
 #include <sctu/cdc_device.h>
+#include <sctu/usb.h>
 
 #include <tusb.h>
 
+#include <FreeRTOS.h>
+#include <event_groups.h>
+#include <semphr.h>
+#include <stream_buffer.h>
+#include <task.h>
+
+#include <algorithm>
+#include <array>
 #include <span>
 
 #include <errno.h>
@@ -14,9 +23,24 @@ extern int errno;
 
 namespace sctu
 {
+	// Moving data in packet sized chunks keeps the bounce buffer on the USB
+	// task's stack small
+	constexpr const size_t chunk_size = CFG_TUD_CDC_EP_BUFSIZE;
+
+	void cdc_device::initialize()
+	{
+		tx_ = xStreamBufferCreateStatic(
+			tx_buffer_size, 1, tx_storage_.data(), &tx_buffer_);
+		rx_ = xStreamBufferCreateStatic(
+			rx_buffer_size, 1, rx_storage_.data(), &rx_buffer_);
+		write_lock_ = xSemaphoreCreateMutexStatic(&write_lock_buffer_);
+		events_ = xEventGroupCreateStatic(&events_buffer_);
+	}
+
 	bool cdc_device::open()
 	{
-		while(!connected_);
+		xEventGroupWaitBits(
+			events_, connected_bit, pdFALSE, pdTRUE, portMAX_DELAY);
 		return true;
 	}
 
@@ -28,28 +52,61 @@ namespace sctu
 	void cdc_device::update()
 	{
 		connected_ = tud_cdc_connected();
-	}
+		if (connected_)
+			xEventGroupSetBits(events_, connected_bit);
+		else
+			xEventGroupClearBits(events_, connected_bit);
 
-	int cdc_device::write(std::span<const unsigned char> data)
-	{
+		std::array<uint8_t, chunk_size> chunk;
 		if (!connected_)
 		{
-			errno = ENXIO;
-			return -1;
+			// Nobody is listening, drop whatever was left behind
+			while (xStreamBufferReceive(tx_, chunk.data(), chunk.size(), 0));
 		}
 
-		if (tud_cdc_write_available() == 0)
+		// Output, as much as TinyUSB's FIFO can take. TinyUSB sends every
+		// full packet on its own.
+		if (!xStreamBufferIsEmpty(tx_))
+			fifo_empty_ = false;
+		for (uint32_t space; (space = tud_cdc_write_available());)
 		{
-			tud_task();
+			const size_t length = xStreamBufferReceive(tx_,
+				chunk.data(), std::min<size_t>(space, chunk.size()), 0);
+			if (!length)
+				break;
+			tud_cdc_write(chunk.data(), length);
+		}
+		// Wait for the writer if it's in the middle of a write, so a short
+		// packet only goes out at the end of it
+		if (xStreamBufferIsEmpty(tx_) && !writing_)
 			tud_cdc_write_flush();
+		if (connected_)
+		{
+			fifo_empty_ = xStreamBufferIsEmpty(tx_) &&
+				tud_cdc_write_available() == CFG_TUD_CDC_TX_BUFSIZE;
 		}
+		else
+		{
+			fifo_empty_ = true;
+		}
+		if (fifo_empty_)
+			xEventGroupSetBits(events_, drained_bit);
 
-		uint32_t result = tud_cdc_write(data.data(), data.size());
-		tud_cdc_write_flush();
-		return static_cast<int>(result);
+		// Input, only as much as readers have room for. Whatever is left
+		// stays in TinyUSB, which stops accepting packets once its FIFO is
+		// full.
+		while (tud_cdc_available())
+		{
+			const size_t space = xStreamBufferSpacesAvailable(rx_);
+			if (!space)
+				break;
+			const uint32_t length = tud_cdc_read(
+				chunk.data(), std::min(space, chunk.size()));
+			xStreamBufferSend(rx_, chunk.data(), length, 0);
+		}
 	}
 
-	int cdc_device::read(std::span<unsigned char> buffer)
+	int cdc_device::write(std::span<const unsigned char> data)
 	{
 		if (!connected_)
 		{
@@ -57,21 +114,59 @@ namespace sctu
 			return -1;
 		}
 
-		while(!tud_cdc_available())
+		xSemaphoreTake(write_lock_, portMAX_DELAY);
+		writing_ = true;
+		std::span<const unsigned char> rest = data;
+		while (!rest.empty() && connected_)
 		{
-			// FIXME some kind of yield?
+			size_t sent = xStreamBufferSend(tx_, rest.data(), rest.size(), 0);
+			if (!sent)
+			{
+				// Full, wait for the USB task to make room for a packet
+				usb_wake();
+				sent = xStreamBufferSend(tx_, rest.data(),
+					std::min(rest.size(), chunk_size), write_timeout);
+				if (!sent)
+					break;
+			}
+			rest = rest.subspan(sent);
+			usb_wake();
 		}
+		writing_ = false;
+		xSemaphoreGive(write_lock_);
+
+		// Let the USB task send the tail of this write
+		usb_wake();
+		return static_cast<int>(data.size() - rest.size());
+	}
 
-		// There is data available
-		size_t read_;
-		for (read_ = 0; read_ < buffer.size() && tud_cdc_available();)
+	int cdc_device::read(std::span<unsigned char> buffer)
+	{
+		open();
+		return read(buffer, portMAX_DELAY);
+	}
+
+	int cdc_device::read(std::span<unsigned char> buffer, TickType_t timeout)
+	{
+		const size_t length = xStreamBufferReceive(
+			rx_, buffer.data(), buffer.size(), timeout);
+		// There's room again, have the USB task bring in more
+		usb_wake();
+		return static_cast<int>(length);
+	}
+
+	bool cdc_device::flush()
+	{
+		usb_wake();
+		while (connected_ && !(xStreamBufferIsEmpty(tx_) && fifo_empty_))
 		{
-			// read and echo back
-			read_ += tud_cdc_read(buffer.data() + read_, buffer.size() - read_);
+			const EventBits_t bits = xEventGroupWaitBits(
+				events_, drained_bit, pdTRUE, pdTRUE, flush_timeout);
+			if (!(bits & drained_bit))
+				return false;
 		}
-		return static_cast<int>(read_);
+		return true;
 	}
 
 	cdc_device cdc;
 }
-
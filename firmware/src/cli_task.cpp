@@ -3,112 +3,1211 @@
 /// @file
 
 #include <sctu/cli_task.h>
+#include <sctu/cdc_device.h>
 #include <sctu/log.h>
+#include <sctu/log_drain.h>
 #include <sctu/usb.h>
 #include <sctu/pio_controllers.h>
+#include <sctu/settings.h>
+#include <sctu/sof_scheduler.h>
+#include <sctu/decoder.h>
+#include <sctu/filter.h>
+#include <sctu/latency.h>
+#include <sctu/loopback.h>
+#include <sctu/run_time_stats.h>
+#include <sctu/capture.h>
+#include <sctu/input_transform.h>
+#include <sctu/config_store.h>
+#include <sctu/boot_time.h>
+#include <sctu/power.h>
+#include <sctu/watchdog.h>
 
 #include <pico/unique_id.h>
 #include <pico/bootrom.h>
 #include <hardware/watchdog.h>
+#include <hardware/clocks.h>
+#include <pico/time.h>
 #include <tusb.h>
 
+#include <charconv>
 #include <cstdint>
 #include <cstdio>
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <span>
+#include <string_view>
+#include <system_error>
 
 using sctu::sys_log;
 
-static void run(const char* line)
+// More than the firmware ever runs: its own tasks, plus the idle and timer
+// tasks
+constexpr const size_t max_tasks = 24;
+
+// Bytes left in the FreeRTOS heap. Static builds don't link any heap, so
+// there's nothing to report there.
+static size_t free_heap()
+{
+#ifdef SCTU_STATIC_ALLOCATION
+	return 0;
+#else
+	return xPortGetFreeHeapSize();
+#endif
+}
+
+// In JSON lines mode there's no prompt or echo, and every command answers
+// with exactly one JSON object per line, for test rigs to parse
+static bool json_mode = false;
+
+// Arguments of a command, the line split on spaces past the command name
+using arguments = std::span<const std::string_view>;
+
+// Parses a whole argument as a number
+template<typename T>
+static bool parse_number(std::string_view text, T& value)
+{
+	const char *end = text.data() + text.size();
+	const auto [last, error] = std::from_chars(text.data(), end, value);
+	return error == std::errc() && last == end;
+}
+
+// Reports an error the way the current mode expects. The message must not
+// need escaping.
+static void fail(std::string_view command, const char *message)
+{
+	if (json_mode)
+		printf("{\"error\":\"%s\"}\r\n", message);
+	else
+		printf("%.*s: %s\r\n", static_cast<int>(command.size()),
+			command.data(), message);
+}
+
+// The CLI's input, read from the CDC as chunks arrive instead of going
+// through newlib one byte at a time. Commands taking binary data after
+// their line, like x replay, must read it through here too, as part of it
+// may already be in the chunk.
+class cli_input
+{
+public:
+	// Returns the next byte, blocking until there's one
+	unsigned char get()
+	{
+		while (position_ == length_)
+		{
+			const int read = sctu::cdc.read(chunk_);
+			length_ = read > 0 ? read : 0;
+			position_ = 0;
+		}
+		return chunk_[position_++];
+	}
+
+	// Fills the buffer, returns false if it didn't fill up within the
+	// timeout. Whatever did arrive is consumed anyway.
+	bool read(std::span<unsigned char> buffer, TickType_t timeout)
+	{
+		TimeOut_t start;
+		vTaskSetTimeOutState(&start);
+		while (!buffer.empty())
+		{
+			if (position_ == length_)
+			{
+				if (xTaskCheckForTimeOut(&start, &timeout))
+					return false;
+				const int read = sctu::cdc.read(chunk_, timeout);
+				length_ = read > 0 ? read : 0;
+				position_ = 0;
+				continue;
+			}
+			const size_t count = std::min(buffer.size(), length_ - position_);
+			std::copy_n(chunk_.begin() + position_, count, buffer.begin());
+			position_ += count;
+			buffer = buffer.subspan(count);
+		}
+		return true;
+	}
+
+	// Whether bytes that already arrived are still waiting to be handled
+	bool pending() const
+	{
+		return position_ != length_;
+	}
+
+private:
+	std::array<unsigned char, 64> chunk_;
+	size_t position_ = 0;
+	size_t length_ = 0;
+};
+
+static cli_input input;
+
+// Average CPU cycles the decoder takes per controller word
+template<typename F>
+static unsigned benchmark_decoder(F&& decoder)
+{
+	constexpr const unsigned iterations = 4096;
+	volatile uint8_t sink = 0;
+
+	// Keep other tasks from skewing the measurement
+	vTaskSuspendAll();
+	const uint64_t start = time_us_64();
+	for (unsigned i = 0; i < iterations; ++i)
+	{
+		// Change the words every iteration, so nothing can be hoisted
+		const std::array<uint32_t, 4> words {
+			i * 0x9E3779B9u, ~i, i << 16 | i, i ^ 0x55555555u };
+		for (const auto& state: decoder(words))
+			sink = sink + state.buttons;
+	}
+	const uint64_t elapsed = time_us_64() - start;
+	xTaskResumeAll();
+
+	return static_cast<unsigned>(
+		elapsed * (clock_get_hz(clk_sys) / 1000000u) / (iterations * 4));
+}
+
+// Measures CPU usage over the given period: the idle time and context
+// switches of each core, and the share of a core each task used
+static void print_cpu_usage(unsigned period_ms)
+{
+	// Only the CLI task gets here, so these can be static instead of on its
+	// small stack
+	static std::array<TaskStatus_t, max_tasks> before;
+	static std::array<TaskStatus_t, max_tasks> after;
+	std::array<sctu::core_stats, sctu::run_time_cores> cores_before;
+	std::array<sctu::core_stats, sctu::run_time_cores> cores_after;
+
+	uint64_t start;
+	for (size_t core = 0; core < cores_before.size(); ++core)
+		cores_before[core] = sctu::get_core_stats(core);
+	const UBaseType_t before_count =
+		uxTaskGetSystemState(before.data(), before.size(), &start);
+
+	vTaskDelay(pdMS_TO_TICKS(period_ms));
+
+	uint64_t end;
+	for (size_t core = 0; core < cores_after.size(); ++core)
+		cores_after[core] = sctu::get_core_stats(core);
+	const UBaseType_t after_count =
+		uxTaskGetSystemState(after.data(), after.size(), &end);
+
+	const uint64_t elapsed_us = std::max<uint64_t>(end - start, 1);
+	if (json_mode)
+		printf("{\"elapsed_ms\":%lu,\"cores\":[",
+			static_cast<unsigned long>(elapsed_us / 1000));
+	else
+		printf("cpu usage over %lu ms:\r\n",
+			static_cast<unsigned long>(elapsed_us / 1000));
+	for (size_t core = 0; core < cores_after.size(); ++core)
+	{
+		const uint64_t idle =
+			cores_after[core].idle_us - cores_before[core].idle_us;
+		const uint64_t switches = cores_after[core].context_switches -
+			cores_before[core].context_switches;
+		const unsigned idle_permille = std::min<uint64_t>(
+			idle * 1000 / elapsed_us, 1000);
+		if (json_mode)
+			printf("%s{\"idle_permille\":%u,\"switches_per_s\":%lu}",
+				core ? "," : "", idle_permille,
+				static_cast<unsigned long>(switches * 1000000 / elapsed_us));
+		else
+			printf("  core %u: %u.%u%% idle, %lu switches/s\r\n",
+				static_cast<unsigned>(core), idle_permille / 10,
+				idle_permille % 10,
+				static_cast<unsigned long>(switches * 1000000 / elapsed_us));
+	}
+	if (json_mode)
+		printf("],\"tasks\":[");
+
+	const char *separator = "";
+	for (const auto& task: std::span(after.data(), after_count))
+	{
+		// Tasks created during the period count from their start
+		uint64_t run_time = task.ulRunTimeCounter;
+		for (const auto& old: std::span(before.data(), before_count))
+		{
+			if (old.xHandle == task.xHandle)
+				run_time -= old.ulRunTimeCounter;
+		}
+		const unsigned permille = std::min<uint64_t>(
+			run_time * 1000 / elapsed_us, 1000);
+		const int core = task.eCurrentState == eDeleted ?
+			-1 : sctu::task_core(task.xHandle);
+		if (json_mode)
+			printf("%s{\"name\":\"%s\",\"permille\":%u,\"core\":%d}",
+				separator, task.pcTaskName, permille, core);
+		else
+			printf("  %-20s %3u.%u%%, core %c\r\n",
+				task.pcTaskName, permille / 10, permille % 10,
+				core < 0 ? '-' : static_cast<char>('0' + core));
+		separator = ",";
+	}
+	if (json_mode)
+		printf("]}\r\n");
+}
+
+// Prints the summary of every latency stage
+static void print_latency(sctu::latency_stage first, sctu::latency_stage last)
+{
+	if (json_mode)
+		printf("{\"stages\":[");
+	for (size_t i = static_cast<size_t>(first); i <= static_cast<size_t>(last); ++i)
+	{
+		const auto stage = static_cast<sctu::latency_stage>(i);
+		const auto summary = sctu::latency.histogram(stage).summarize();
+		if (json_mode)
+			printf("%s{\"name\":\"%s\",\"count\":%lu,\"min_us\":%lu,"
+				"\"average_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu}",
+				i == static_cast<size_t>(first) ? "" : ",",
+				sctu::to_string(stage), summary.count, summary.min_us,
+				summary.average_us, summary.p99_us, summary.max_us);
+		else
+			printf("%s: %lu samples, min %lu us, avg %lu us, p99 %lu us, "
+				"max %lu us\r\n",
+				sctu::to_string(stage), summary.count, summary.min_us,
+				summary.average_us, summary.p99_us, summary.max_us);
+	}
+	if (json_mode)
+		printf("]}\r\n");
+}
+
+// Writes every latency histogram in binary: the bytes "SCTL", the number of
+// stages, buckets, and sub-bucket bits as 32 bit words, and then a
+// latency_histogram::copy per stage, all little endian. In JSON lines mode
+// a line with the size of the dump comes first.
+static void dump_latency()
+{
+	constexpr const std::array<char, 4> magic { 'S', 'C', 'T', 'L' };
+	const std::array<uint32_t, 3> header {
+		static_cast<uint32_t>(sctu::latency_stage_count),
+		static_cast<uint32_t>(sctu::latency_histogram::bucket_count),
+		sctu::latency_histogram::sub_bits,
+	};
+	if (json_mode)
+		printf("{\"dump_bytes\":%u}\r\n", static_cast<unsigned>(
+			magic.size() + sizeof(header) + sctu::latency_stage_count *
+				sizeof(sctu::latency_histogram::copy)));
+	fwrite(magic.data(), 1, magic.size(), stdout);
+	fwrite(header.data(), sizeof(header[0]), header.size(), stdout);
+	for (size_t i = 0; i < sctu::latency_stage_count; ++i)
+	{
+		// Too large for the CLI task's stack
+		static sctu::latency_histogram::copy histogram;
+		histogram = sctu::latency.histogram(
+			static_cast<sctu::latency_stage>(i)).read();
+		fwrite(&histogram, sizeof(histogram), 1, stdout);
+	}
+	fflush(stdout);
+}
+
+// Presses and releases B on the loopback tester, with random gaps so the
+// changes land at every point of the sampling and polling cycles
+static void run_loopback(unsigned cycles)
+{
+	if (!sctu::loopback.start())
+	{
+		fail("t", "no pin or PIO resources for the loopback tester");
+		return;
+	}
+
+	// Give the host time to enumerate the new controller
+	vTaskDelay(pdMS_TO_TICKS(1000));
+	sctu::latency.reset();
+
+	uint32_t random = time_us_32();
+	for (unsigned i = 0; i < 2 * cycles; ++i)
+	{
+		sctu::loopback.set_pressed(!(i & 1));
+		random = random * 1664525u + 1013904223u;
+		vTaskDelay(pdMS_TO_TICKS(50 + (random >> 16) % 51));
+	}
+
+	sctu::loopback.stop();
+	print_latency(sctu::latency_stage::loopback, sctu::latency_stage::loopback);
+}
+
+// Prints the capture counters and those of the last replay
+static void print_capture()
+{
+	const auto capture = sctu::capture.get_stats();
+	const auto replay = sctu::replay.get_stats();
+	if (json_mode)
+	{
+		printf("{\"capture\":{\"active\":%s,\"records\":%lu,\"dropped\":%lu},"
+			"\"replay\":{\"active\":%s,\"records\":%lu,\"underruns\":%lu}}\r\n",
+			sctu::capture.active() ? "true" : "false",
+			capture.records, capture.dropped,
+			sctu::replay.active() ? "true" : "false",
+			replay.records, replay.underruns);
+		return;
+	}
+	printf("capture: %s, %lu records, %lu dropped\r\n",
+		sctu::capture.active() ? "on" : "off",
+		capture.records, capture.dropped);
+	printf("replay: %s, %lu records, %lu underruns\r\n",
+		sctu::replay.active() ? "on" : "off",
+		replay.records, replay.underruns);
+}
+
+// How long the host may take to send a whole frame, past that it's gone or
+// the frame was cut short
+constexpr const TickType_t frame_timeout = pdMS_TO_TICKS(1000);
+
+// Reads one frame of capture records from the host and feeds it to the
+// replay, returns the number of records or -1 if the frame is bad or late
+static int feed_frame()
+{
+	sctu::capture_frame header;
+	if (!input.read(std::span(reinterpret_cast<unsigned char*>(&header),
+			sizeof(header)), frame_timeout) ||
+		header.sync != sctu::capture_sync ||
+		header.ports != sctu::port_count ||
+		header.count > sctu::max_frame_records)
+		return -1;
+
+	// Only the CLI task gets here, so this can be static instead of on its
+	// small stack
+	static std::array<sctu::capture_record, sctu::max_frame_records> records;
+	if (!input.read(std::span(reinterpret_cast<unsigned char*>(records.data()),
+			sizeof(records[0]) * header.count), frame_timeout))
+		return -1;
+	for (const auto& record: std::span(records.data(), header.count))
+		sctu::replay.feed(record);
+	return header.count;
+}
+
+// Plays back the frames the host sends, until one with no records, and waits
+// for the controller task to finish with them
+static void run_replay()
 {
-	if (line[0] == 's')
+	if (!sctu::replay.begin())
 	{
-		printf("ticks: %lu\r\n", xTaskGetTickCount());
-		printf("Heap: %u\r\n", xPortGetFreeHeapSize());
-		UBaseType_t number_of_tasks = uxTaskGetNumberOfTasks();
-		printf("Tasks active: %lu\r\n", number_of_tasks);
-		std::vector<TaskStatus_t> tasks(number_of_tasks);
-		uxTaskGetSystemState(tasks.data(), tasks.size(), nullptr);
-		for (const auto& status: tasks)
+		fail("x", "replay already running");
+		return;
+	}
+	if (json_mode)
+		printf("{\"waiting\":true}\r\n");
+	else
+		printf("replay: waiting for frames\r\n");
+	fflush(stdout);
+
+	// Past a bad frame the stream can't be trusted, so don't play what's
+	// left of it either, the live controllers take over again
+	int records;
+	while ((records = feed_frame()) > 0);
+	if (records < 0)
+		sctu::replay.cancel();
+	else
+		sctu::replay.end();
+	while (sctu::replay.active())
+		vTaskDelay(pdMS_TO_TICKS(10));
+	if (records < 0)
+		fail("x", "bad frame, replay stopped");
+	// In JSON lines mode the error is the whole answer
+	if (records >= 0 || !json_mode)
+		print_capture();
+}
+
+// Prints what every player's transforms change, skipping players left alone.
+// In JSON, recorded is the number of steps just recorded, -1 for none.
+static void print_transforms(int recorded = -1)
+{
+	std::array<char, 48> buttons;
+	if (json_mode)
+		printf("{\"players\":[");
+	const char *separator = "";
+	for (size_t player = 0; player < sctu::max_players; ++player)
+	{
+		const sctu::transform_config& config =
+			sctu::input_transforms.config(player);
+		if (config.identity())
+			continue;
+		if (json_mode)
 		{
-			printf("  task name: %s\r\n", status.pcTaskName);
-			printf("  task mark: %lu\r\n", status.usStackHighWaterMark);
+			// Button names never need escaping
+			printf("%s{\"player\":%u,\"remap\":{", separator, player + 1);
+			separator = ",";
+			const char *remap_separator = "";
+			for (size_t bit = 0; bit < config.remap.size(); ++bit)
+			{
+				if (config.remap[bit] == 1 << bit)
+					continue;
+				printf("%s\"%.*s\":\"%s\"", remap_separator,
+					static_cast<int>(sctu::button_names[bit].size()),
+					sctu::button_names[bit].data(),
+					sctu::format_buttons(config.remap[bit], buttons).data());
+				remap_separator = ",";
+			}
+			printf("},\"turbo\":\"%s\",\"turbo_hz\":%u,",
+				sctu::format_buttons(config.turbo, buttons).data(),
+				config.turbo_hz);
+			printf("\"macro_trigger\":\"%s\",\"macro\":[",
+				sctu::format_buttons(config.macro_trigger, buttons).data());
+			for (size_t i = 0; i < config.macro_length; ++i)
+				printf("%s{\"buttons\":\"%s\",\"ms\":%u}", i ? "," : "",
+					sctu::format_buttons(config.macro[i].buttons, buttons).data(),
+					config.macro[i].duration_ms);
+			printf("]}");
+			continue;
 		}
 
-		char foo[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
-		pico_get_unique_board_id_string(foo, sizeof(foo));
-		printf("unique id: %s\r\n", foo);
+		printf("player %u:\r\n", player + 1);
+		for (size_t bit = 0; bit < config.remap.size(); ++bit)
+		{
+			if (config.remap[bit] != 1 << bit)
+				printf("  remap %.*s: %s\r\n",
+					static_cast<int>(sctu::button_names[bit].size()),
+					sctu::button_names[bit].data(),
+					sctu::format_buttons(config.remap[bit], buttons).data());
+		}
+		if (config.turbo)
+			printf("  turbo %s at %u Hz\r\n",
+				sctu::format_buttons(config.turbo, buttons).data(),
+				config.turbo_hz);
+		if (config.macro_trigger && config.macro_length)
+		{
+			printf("  macro on %s:\r\n",
+				sctu::format_buttons(config.macro_trigger, buttons).data());
+			for (const auto& step: std::span(
+					config.macro.data(), config.macro_length))
+				printf("    %s %u ms\r\n",
+					sctu::format_buttons(step.buttons, buttons).data(),
+					step.duration_ms);
+		}
+	}
+
+	const int recording = sctu::input_transforms.recording();
+	if (json_mode)
+	{
+		printf("],\"recording\":%d", recording >= 0 ? recording + 1 : 0);
+		if (recorded >= 0)
+			printf(",\"recorded\":%d", recorded);
+		printf("}\r\n");
+		return;
+	}
+	if (recorded >= 0)
+		printf("recorded %d steps\r\n", recorded);
+	if (recording >= 0)
+		printf("recording player %d\r\n", recording + 1);
+}
+
+// Edits the transforms of a player, see the 'm' command. Returns false
+// after reporting what's wrong.
+static bool edit_transform(arguments args)
+{
+	unsigned player;
+	if (args.size() < 2 || !parse_number(args[0], player) ||
+		player < 1 || player > sctu::max_players)
+	{
+		fail("m", "bad arguments");
+		return false;
+	}
+	--player;
 
-		printf("log size: %u\r\n", sys_log.size());
-		for (size_t i = 0; i < sys_log.size(); ++i)
+	const std::string_view verb = args[1];
+	const std::string_view first = args.size() > 2 ? args[2] : "";
+	const std::string_view second = args.size() > 3 ? args[3] : "";
+	sctu::transform_config config = sctu::input_transforms.config(player);
+	const int buttons = sctu::parse_buttons(first);
+	if (verb == "clear")
+	{
+		config = {};
+	}
+	else if (verb == "record")
+	{
+		const bool started = sctu::input_transforms.start_recording(player);
+		if (!started)
+			fail("m", "already recording");
+		return started;
+	}
+	else if (buttons < 0)
+	{
+		fail("m", "unknown buttons");
+		return false;
+	}
+	else if (verb == "remap")
+	{
+		// One input button at a time
+		const int to = sctu::parse_buttons(second);
+		if (!std::has_single_bit(static_cast<unsigned>(buttons)) || to < 0)
 		{
-			printf("log %u: %s\r\n", i, sys_log[i].c_str());
+			fail("m", "remap takes a button and what it presses");
+			return false;
 		}
+		config.remap[std::countr_zero(static_cast<unsigned>(buttons))] = to;
+	}
+	else if (verb == "turbo")
+	{
+		config.turbo = buttons;
+		unsigned long hz;
+		if (parse_number(second, hz) && hz)
+			config.turbo_hz = std::clamp(hz, 1ul, 50ul);
+	}
+	else if (verb == "macro")
+	{
+		config.macro_trigger = buttons;
+	}
+	else if (verb == "step")
+	{
+		if (config.macro_length == config.macro.size())
+		{
+			fail("m", "macro is full");
+			return false;
+		}
+		unsigned long ms = 0;
+		parse_number(second, ms);
+		config.macro[config.macro_length++] = {
+			.buttons = static_cast<uint8_t>(buttons),
+			.duration_ms = static_cast<uint16_t>(std::clamp(ms, 1ul, 60000ul)),
+		};
+	}
+	else
+	{
+		fail("m", "unknown action");
+		return false;
+	}
+	sctu::input_transforms.set_config(player, config);
+	return true;
+}
+
+// s: show tasks, boot times, heartbeats and the log
+static void status_command(arguments)
+{
+	const int reset = sctu::supervisor.reset_heartbeat();
+	const bool reset_known =
+		reset >= 0 && static_cast<size_t>(reset) < sctu::supervisor.size();
+	const auto drain = sctu::sys_log_drain.get_stats();
+	if (json_mode)
+	{
+		printf("{\"ticks\":%lu,\"heap\":%u,\"tasks\":%lu,\"boot_us\":{",
+			xTaskGetTickCount(), free_heap(),
+			uxTaskGetNumberOfTasks());
+		for (size_t i = 0; i < sctu::boot_stage_count; ++i)
+		{
+			const auto stage = static_cast<sctu::boot_stage>(i);
+			printf("%s\"%s\":%lu", i ? "," : "", sctu::to_string(stage),
+				sctu::boot_times.time_us(stage));
+		}
+		printf("},\"heartbeats\":[");
+		for (size_t i = 0; i < sctu::supervisor.size(); ++i)
+		{
+			const auto heartbeat = sctu::supervisor.get_stats(i);
+			printf("%s{\"name\":\"%s\",\"deadline_us\":%lu,\"beats\":%lu,"
+				"\"misses\":%lu,\"worst_us\":%lu,\"recoveries\":%lu}",
+				i ? "," : "", heartbeat.name, heartbeat.deadline_us,
+				heartbeat.beats, heartbeat.misses, heartbeat.worst_us,
+				heartbeat.recoveries);
+		}
+		printf("],\"last_reset\":");
+		if (reset_known)
+			printf("\"%s\"", sctu::supervisor.get_stats(reset).name);
+		else
+			printf("null");
+		printf(",\"log\":{\"size\":%u,\"records\":%lu,\"dropped\":%lu,"
+			"\"sink_dropped\":%lu}}\r\n",
+			sys_log.size(), drain.records, drain.dropped, drain.sink_dropped);
+		return;
+	}
+
+	printf("ticks: %lu\r\n", xTaskGetTickCount());
+	printf("Heap: %u\r\n", free_heap());
+	UBaseType_t number_of_tasks = uxTaskGetNumberOfTasks();
+	printf("Tasks active: %lu\r\n", number_of_tasks);
+	// Only the CLI task gets here, so this can be static instead of on its
+	// small stack
+	static std::array<TaskStatus_t, max_tasks> tasks;
+	number_of_tasks = uxTaskGetSystemState(
+		tasks.data(), tasks.size(), nullptr);
+	for (const auto& status: std::span(tasks.data(), number_of_tasks))
+	{
+		printf("  task name: %s\r\n", status.pcTaskName);
+		printf("  task mark: %lu\r\n", status.usStackHighWaterMark);
+	}
+
+	// Every boot stage, since reset and since the previous one
+	uint32_t previous_us = 0;
+	for (size_t i = 0; i < sctu::boot_stage_count; ++i)
+	{
+		const auto stage = static_cast<sctu::boot_stage>(i);
+		const uint32_t time_us = sctu::boot_times.time_us(stage);
+		if (!time_us)
+		{
+			printf("boot %s: not yet\r\n", sctu::to_string(stage));
+			continue;
+		}
+		printf("boot %s: %lu us (+%lu us)\r\n", sctu::to_string(stage),
+			time_us, time_us - previous_us);
+		previous_us = time_us;
 	}
 
-	if (line[0] == 'r')
+	// Every heartbeat, and the one that reset the board last time
+	if (reset_known)
+		printf("last reset: missed by %s\r\n",
+			sctu::supervisor.get_stats(reset).name);
+	for (size_t i = 0; i < sctu::supervisor.size(); ++i)
 	{
-		printf("Rebooting to programming mode...\r\n");
-		fflush(stdout);
-		reset_usb_boot(0,0);
+		const auto heartbeat = sctu::supervisor.get_stats(i);
+		printf("heartbeat %s: deadline %lu us, %lu beats, %lu missed, "
+			"worst %lu us, %lu recoveries\r\n",
+			heartbeat.name, heartbeat.deadline_us, heartbeat.beats,
+			heartbeat.misses, heartbeat.worst_us, heartbeat.recoveries);
 	}
 
-	if (line[0] == 'k')
+	char foo[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+	pico_get_unique_board_id_string(foo, sizeof(foo));
+	printf("unique id: %s\r\n", foo);
+
+	printf("log size: %u\r\n", sys_log.size());
+	printf("log drain: %lu records, %lu dropped by the log, "
+		"%lu dropped by the outputs\r\n",
+		drain.records, drain.dropped, drain.sink_dropped);
+	std::array<char, decltype(sys_log)::max_record_size> buffer;
+	auto cursor = sys_log.begin();
+	for (size_t i = 0; auto entry = sys_log.read(cursor, buffer); ++i)
 	{
-		printf("Killing (hanging)...\r\n");
-		fflush(stdout);
-		// Just kill one of the watchdogs, should bring down the entire board
-		TaskHandle_t handle = xTaskGetHandle("watchdog_cpu0");
-		vTaskDelete(handle);
-		for(;;);
+		// [seconds].[decimals, 6 digits] - [level]: [log  contents]
+		printf("log %u: %llu.%06llu - %s: %.*s\r\n", i,
+			entry->time_us / 1000000, entry->time_us % 1000000,
+			sctu::to_string(entry->level),
+			static_cast<int>(entry->text.size()), entry->text.data());
 	}
+}
+
+// r: reboot to the bootloader
+static void reboot_command(arguments)
+{
+	printf("Rebooting to programming mode...\r\n");
+	fflush(stdout);
+	sctu::cdc.flush();
+	reset_usb_boot(0,0);
+}
 
-	if (line[0] == 'c')
+// k: hang the board, to test the watchdog
+static void kill_command(arguments)
+{
+	printf("Killing (hanging)...\r\n");
+	fflush(stdout);
+	sctu::cdc.flush();
+	// Just kill one of the watchdogs, should bring down the entire board
+	TaskHandle_t handle = xTaskGetHandle("sctu_watchdog_cpu0");
+	vTaskDelete(handle);
+	for(;;);
+}
+
+// c: show the controllers, re-enumerations and low power stats
+static void controllers_command(arguments)
+{
+	const usb_reenumeration_stats stats = usb_get_reenumeration_stats();
+	const auto power = sctu::power.get_stats();
+	if (json_mode)
 	{
-		printf("Current controllers: %01X\r\n", usb_get_active_controllers());
+		printf("{\"active\":%u,\"enumerated\":%u,\"requests\":%lu,"
+			"\"reenumerations\":%lu,\"suppressed\":%lu,\"suspended\":%s,"
+			"\"suspends\":%lu,\"low_power_ms\":%lu}\r\n",
+			usb_get_active_controllers(), usb_get_enumerated_controllers(),
+			stats.requests, stats.reenumerations, stats.suppressed,
+			usb_suspended() ? "true" : "false",
+			power.suspends, power.low_power_ms);
+		return;
 	}
+	printf("Current controllers: %02X\r\n", usb_get_active_controllers());
+	printf("Enumerated controllers: %02X\r\n", usb_get_enumerated_controllers());
+	printf("re-enumerations: %lu requested, %lu done, %lu suppressed\r\n",
+		stats.requests, stats.reenumerations, stats.suppressed);
+	printf("suspended: %s, %lu suspends, %lu ms in low power\r\n",
+		usb_suspended() ? "yes" : "no", power.suspends, power.low_power_ms);
+}
+
+// a [rate]: show or set the autopoll rate in Hz, 0 disables it
+static void autopoll_command(arguments args)
+{
+	unsigned long rate;
+	if (!args.empty())
+	{
+		if (!parse_number(args[0], rate))
+		{
+			fail("a", "rate must be a number");
+			return;
+		}
+		if (rate)
+			rate = std::clamp<unsigned long>(rate,
+				sctu::pio_controllers::min_autopoll_hz,
+				sctu::pio_controllers::max_autopoll_hz);
+		sctu::system_settings.autopoll_hz = rate;
+	}
+	printf(json_mode ? "{\"autopoll_hz\":%u}\r\n" : "autopoll: %u Hz\r\n",
+		static_cast<unsigned>(sctu::system_settings.autopoll_hz));
+}
+
+// i [ms]: show or set the HID report interval
+static void interval_command(arguments args)
+{
+	unsigned long interval;
+	if (!args.empty())
+	{
+		if (!parse_number(args[0], interval) ||
+			!sctu::valid_report_interval(interval))
+		{
+			fail("i", "interval must be one of 1, 2, 4, 8, 10");
+			return;
+		}
+		sctu::system_settings.report_interval_ms = interval;
+	}
+	printf(json_mode ?
+			"{\"report_interval_ms\":%u}\r\n" : "report interval: %u ms\r\n",
+		static_cast<unsigned>(sctu::system_settings.report_interval_ms));
+}
+
+// h [dynamic|fixed|combined]: show or set the HID interface layout
+static void layout_command(arguments args)
+{
+	constexpr const std::array<std::string_view, 3> layouts {
+		"dynamic", "fixed", "combined" };
+	if (!args.empty())
+	{
+		const auto found = std::ranges::find(layouts, args[0]);
+		if (found == layouts.end())
+		{
+			fail("h", "layout must be dynamic, fixed or combined");
+			return;
+		}
+		sctu::system_settings.layout =
+			static_cast<sctu::hid_layout>(found - layouts.begin());
+	}
+	const std::string_view layout =
+		layouts[static_cast<size_t>(sctu::system_settings.layout.load())];
+	printf(json_mode ? "{\"layout\":\"%.*s\"}\r\n" : "hid layout: %.*s\r\n",
+		static_cast<int>(layout.size()), layout.data());
+}
+
+// p [lead|off]: show SOF phase error, set the latch lead in us or disable SOF
+// scheduling
+static void sof_command(arguments args)
+{
+	unsigned long lead;
+	if (!args.empty() && args[0] == "off")
+	{
+		sctu::system_settings.sof_sync = false;
+	}
+	else if (!args.empty())
+	{
+		if (!parse_number(args[0], lead))
+		{
+			fail("p", "lead must be a number or off");
+			return;
+		}
+		sctu::system_settings.sof_lead_us = std::min(lead, 10000ul);
+		sctu::system_settings.sof_sync = true;
+		sctu::sof.reset_stats();
+	}
+
+	const auto stats = sctu::sof.stats();
+	if (json_mode)
+	{
+		printf("{\"sof_sync\":%s,\"sof_lead_us\":%u,\"min_us\":%ld,"
+			"\"average_us\":%ld,\"max_us\":%ld,\"reports\":%lu}\r\n",
+			sctu::system_settings.sof_sync ? "true" : "false",
+			static_cast<unsigned>(sctu::system_settings.sof_lead_us),
+			stats.min_us, stats.average_us, stats.max_us, stats.reports);
+		return;
+	}
+	printf("sof sync: %s, lead %u us\r\n",
+		sctu::system_settings.sof_sync ? "on" : "off",
+		static_cast<unsigned>(sctu::system_settings.sof_lead_us));
+	printf("phase error: min %ld us, avg %ld us, max %ld us, %lu reports\r\n",
+		stats.min_us, stats.average_us, stats.max_us, stats.reports);
+}
+
+// f [samples [budget]]: show or set the glitch filter window, and the
+// latency budget in us
+static void filter_command(arguments args)
+{
+	unsigned long samples;
+	unsigned long budget;
+	if (!args.empty())
+	{
+		if (!parse_number(args[0], samples) ||
+			(args.size() > 1 && !parse_number(args[1], budget)))
+		{
+			fail("f", "samples and budget must be numbers");
+			return;
+		}
+		sctu::system_settings.filter_samples =
+			std::clamp<unsigned long>(samples, 1, sctu::max_filter_samples);
+		if (args.size() > 1)
+			sctu::system_settings.filter_budget_us = std::min(budget, 10000ul);
+	}
+
+	const unsigned hz = sctu::system_settings.autopoll_hz;
+	const unsigned period_us = hz ?
+		1000000u / hz : sctu::system_settings.report_interval_ms * 1000u;
+	const unsigned effective = sctu::filter_samples(
+		sctu::system_settings.filter_samples,
+		period_us,
+		sctu::system_settings.filter_budget_us);
+	const unsigned latency_us = (effective - 1) / 2 * period_us;
+	if (json_mode)
+	{
+		printf("{\"filter_samples\":%u,\"used\":%u,\"filter_budget_us\":%u,"
+			"\"latency_us\":%u}\r\n",
+			static_cast<unsigned>(sctu::system_settings.filter_samples),
+			effective,
+			static_cast<unsigned>(sctu::system_settings.filter_budget_us),
+			latency_us);
+		return;
+	}
+	printf("filter: %u samples requested, %u used, budget %u us\r\n",
+		static_cast<unsigned>(sctu::system_settings.filter_samples),
+		effective,
+		static_cast<unsigned>(sctu::system_settings.filter_budget_us));
+	printf("filter latency: %u us\r\n", latency_us);
+}
+
+// l [text|binary]: show or set the log drain output format
+static void log_command(arguments args)
+{
+	if (!args.empty())
+	{
+		if (args[0] != "binary" && args[0] != "text")
+		{
+			fail("l", "format must be text or binary");
+			return;
+		}
+		sctu::sys_log_drain.set_binary(args[0] == "binary");
+	}
+	printf(json_mode ? "{\"log\":\"%s\"}\r\n" : "log output: %s\r\n",
+		sctu::sys_log_drain.binary() ? "binary" : "text");
+}
+
+// d: benchmark the controller decoders
+static void decoder_command(arguments)
+{
+	const unsigned reference = benchmark_decoder(
+		[](const std::array<uint32_t, 4>& words)
+		{
+			std::array<sctu::controller, 4> result;
+			for (size_t i = 0; i < words.size(); ++i)
+				result[i] = sctu::decode_reference(words[i]);
+			return result;
+		});
+	const unsigned table = benchmark_decoder(
+		[](const std::array<uint32_t, 4>& words)
+		{
+			std::array<sctu::controller, 4> result;
+			for (size_t i = 0; i < words.size(); ++i)
+				result[i] = sctu::decode(words[i]);
+			return result;
+		});
+	printf(json_mode ?
+			"{\"reference_cycles\":%u,\"table_cycles\":%u}\r\n" :
+			"decode: reference %u cycles/word, table %u cycles/word\r\n",
+		reference, table);
+}
+
+// u [ms]: measure CPU usage over a period, a second by default
+static void usage_command(arguments args)
+{
+	unsigned long period = 1000;
+	if (!args.empty() && !parse_number(args[0], period))
+	{
+		fail("u", "period must be a number");
+		return;
+	}
+	print_cpu_usage(std::clamp<unsigned long>(period, 10, 10000));
+}
+
+// t [reset|dump|loop [cycles]]: show, clear or dump the latency histograms,
+// or measure them through the loopback tester
+static void latency_command(arguments args)
+{
+	const std::string_view action = args.empty() ? "" : args[0];
+	if (action == "reset")
+	{
+		sctu::latency.reset();
+	}
+	else if (action == "dump")
+	{
+		dump_latency();
+		return;
+	}
+	else if (action == "loop")
+	{
+		unsigned long cycles = 100;
+		if (args.size() > 1 && !parse_number(args[1], cycles))
+		{
+			fail("t", "cycles must be a number");
+			return;
+		}
+		run_loopback(std::clamp<unsigned long>(cycles, 1, 1000));
+		return;
+	}
+	else if (!action.empty())
+	{
+		fail("t", "unknown action");
+		return;
+	}
+	print_latency(sctu::latency_stage::trigger_to_ready,
+		sctu::latency_stage::loopback);
+}
+
+// x [capture|stop|replay]: show capture and replay counters, stream raw hub
+// samples over CDC, or play back samples from the host
+static void capture_command(arguments args)
+{
+	const std::string_view action = args.empty() ? "" : args[0];
+	if (action == "capture")
+	{
+		// Acknowledge before the first frame can go out
+		if (json_mode)
+		{
+			printf("{\"capture\":true}\r\n");
+			fflush(stdout);
+		}
+		// A log record between frames would have the host resync
+		sctu::sys_log_drain.set_cdc_muted(true);
+		sctu::capture.start();
+		return;
+	}
+	else if (action == "stop")
+	{
+		sctu::capture.stop();
+		sctu::sys_log_drain.set_cdc_muted(json_mode);
+	}
+	else if (action == "replay")
+	{
+		run_replay();
+		return;
+	}
+	else if (!action.empty())
+	{
+		fail("x", "unknown action");
+		return;
+	}
+	print_capture();
+}
+
+// m [player action [buttons [value]] | stop [trigger]]: show or edit turbo,
+// remapping and macros. Actions are clear, remap from to, turbo buttons
+// [hz], macro trigger, step buttons ms, and record, until m stop, which sets
+// the trigger of the recorded macro. Buttons are names joined by '+', or '-'
+// for none.
+static void transform_command(arguments args)
+{
+	int recorded = -1;
+	if (!args.empty() && args[0] == "stop")
+	{
+		const int trigger = args.size() > 1 ? sctu::parse_buttons(args[1]) : 0;
+		recorded = sctu::input_transforms.stop_recording(
+			trigger > 0 ? trigger : 0);
+	}
+	else if (!args.empty() && !edit_transform(args) && json_mode)
+	{
+		// The error is the whole answer
+		return;
+	}
+	print_transforms(recorded);
+}
+
+// w [show|erase]: save the settings and transforms to flash, show where they
+// are, or erase them so the next boot uses the defaults. Saving or erasing
+// stops both cores for a moment.
+static void config_command(arguments args)
+{
+	const std::string_view action = args.empty() ? "" : args[0];
+	bool done = true;
+	if (action == "erase")
+		done = sctu::settings_store.erase();
+	else if (action != "show")
+		done = sctu::save_settings();
+
+	const auto stats = sctu::settings_store.get_stats();
+	if (json_mode)
+	{
+		printf("{\"ok\":%s,\"slot\":%d,\"sequence\":%lu,\"saves\":%lu,"
+			"\"erases\":%lu}\r\n", done ? "true" : "false",
+			stats.slot, stats.sequence, stats.saves, stats.erases);
+		return;
+	}
+	if (!done)
+		printf("config: flash write failed\r\n");
+	printf("config: slot %d, sequence %lu, %lu saves, %lu erases\r\n",
+		stats.slot, stats.sequence, stats.saves, stats.erases);
+}
+
+// j [on|off]: show or switch JSON lines mode
+static void json_command(arguments args)
+{
+	if (!args.empty())
+	{
+		if (args[0] != "on" && args[0] != "off")
+		{
+			fail("j", "mode must be on or off");
+			return;
+		}
+		json_mode = args[0] == "on";
+		// Any log record in the middle would break an answer, or a frame
+		// of a capture
+		sctu::sys_log_drain.set_cdc_muted(json_mode || sctu::capture.active());
+	}
+	printf(json_mode ? "{\"json\":true}\r\n" : "json: off\r\n");
+}
+
+static void help_command(arguments);
+
+/** A CLI command, run with the arguments after its name. */
+struct command
+{
+	std::string_view name;
+	/// Shown by the help command.
+	const char *usage;
+	void (*run)(arguments args);
+	/// Whether the command answers in JSON in JSON lines mode, the others
+	/// are refused there.
+	bool json;
+};
+
+static constexpr const std::array<command, 18> commands {{
+	{ "s", "show tasks, boot times, heartbeats and the log", status_command, true },
+	{ "r", "reboot to programming mode", reboot_command, false },
+	{ "k", "hang the board to test the watchdog", kill_command, false },
+	{ "c", "show controllers, re-enumerations and suspends", controllers_command, true },
+	{ "a", "[rate]: autopoll rate in Hz, 0 disables it", autopoll_command, true },
+	{ "i", "[ms]: HID report interval", interval_command, true },
+	{ "h", "[dynamic|fixed|combined]: HID interface layout", layout_command, true },
+	{ "p", "[lead|off]: SOF latch lead in us, and phase error", sof_command, true },
+	{ "f", "[samples [budget]]: glitch filter and its latency budget in us", filter_command, true },
+	{ "l", "[text|binary]: log output format", log_command, true },
+	{ "d", "benchmark the controller decoders", decoder_command, true },
+	{ "u", "[ms]: CPU usage over a period", usage_command, true },
+	{ "t", "[reset|dump|loop [cycles]]: latency histograms", latency_command, true },
+	{ "x", "[capture|stop|replay]: raw sample capture and replay", capture_command, true },
+	{ "m", "[player action [buttons [value]]|stop [trigger]]: turbo, remapping and macros", transform_command, true },
+	{ "w", "[show|erase]: save settings to flash", config_command, true },
+	{ "j", "[on|off]: JSON lines mode", json_command, true },
+	{ "?", "list commands", help_command, true },
+}};
+
+// ?: list every command
+static void help_command(arguments)
+{
+	if (json_mode)
+	{
+		printf("{\"commands\":[");
+		for (size_t i = 0; i < commands.size(); ++i)
+			printf("%s\"%.*s\"", i ? "," : "",
+				static_cast<int>(commands[i].name.size()),
+				commands[i].name.data());
+		printf("]}\r\n");
+		return;
+	}
+	for (const auto& entry: commands)
+		printf("%.*s %s\r\n", static_cast<int>(entry.name.size()),
+			entry.name.data(), entry.usage);
+}
+
+// Most arguments any command takes, and the longest line accepted
+constexpr const size_t max_arguments = 6;
+constexpr const size_t max_line = 96;
+
+static void run(std::string_view line)
+{
+	// Split on spaces, anything past the last argument is left out
+	std::array<std::string_view, max_arguments + 1> words;
+	size_t count = 0;
+	while (count < words.size())
+	{
+		const size_t start = line.find_first_not_of(' ');
+		if (start == line.npos)
+			break;
+		line.remove_prefix(start);
+		const size_t end = std::min(line.find(' '), line.size());
+		words[count++] = line.substr(0, end);
+		line.remove_prefix(end);
+	}
+	if (!count)
+		return;
+
+	const auto found = std::ranges::find(commands, words[0], &command::name);
+	if (found == commands.end())
+	{
+		fail("cli", "unknown command, ? lists them");
+		return;
+	}
+	if (json_mode && !found->json)
+	{
+		fail(found->name, "not available in JSON lines mode");
+		return;
+	}
+	found->run(arguments(words.data() + 1, count - 1));
+}
+
+static void prompt()
+{
+	if (!json_mode)
+		printf("> ");
 }
 
 namespace sctu
 {
 	void cli_task(void*)
 	{
-		std::array<char, 33> line = {0};
-		unsigned int pos = 0;
-		printf("> ");
+		// Only the CLI uses stdout, so let it fill up and go out in one write
+		// once the input that arrived is handled, instead of one write per
+		// echoed character. It holds any JSON answer whole, so each one goes
+		// out in a single CDC write, which nothing else can split.
+		static std::array<char, cdc_device::tx_buffer_size> output;
+		setvbuf(stdout, output.data(), _IOFBF, output.size());
+
+		std::array<char, max_line> line;
+		size_t length = 0;
+		bool overflow = false;
+		unsigned char previous = 0;
+		prompt();
 		for(;;)
 		{
-			fflush(stdout);
-			int c = fgetc(stdin);
-			if (c != EOF)
+			if (!input.pending())
+				fflush(stdout);
+			const unsigned char c = input.get();
+			const bool crlf = previous == '\r' && c == '\n';
+			previous = c;
+			if (crlf)
+				continue;
+
+			if (c == '\r' || c == '\n')
 			{
-				if (c == '\r')
-				{
+				if (!json_mode)
 					printf("\r\n");
-					line[pos] = '\0';
-					run(line.data());
-					pos = 0;
-					printf("> ");
-					continue;
-				}
-				if (c == '\b')
+				if (overflow)
+					fail("cli", "line too long");
+				else
+					run(std::string_view(line.data(), length));
+				if (json_mode)
+					fflush(stdout);
+				length = 0;
+				overflow = false;
+				prompt();
+				continue;
+			}
+			if (c == '\b' || c == 0x7F)
+			{
+				if (length > 0)
 				{
-					if (pos > 0)
-					{
-						--pos;
+					--length;
+					if (!json_mode)
 						printf("\b \b");
-					}
-					continue;
 				}
+				continue;
+			}
 
-				if (pos < (sizeof(line) - 1))
-				{
-					line[pos++] = c;
-					printf("%c", c);
-				}
+			if (length < line.size())
+			{
+				line[length++] = c;
+				if (!json_mode)
+					putchar(c);
 			}
 			else
 			{
-				printf("WTF, we got an EOF?\r\n");
+				overflow = true;
 			}
 		}
 	}
@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/config_store.h>
+#include <sctu/filter.h>
+#include <sctu/input_transform.h>
+#include <sctu/log.h>
+#include <sctu/pio_controllers.h>
+#include <sctu/settings.h>
+#include <sctu/static_task.h>
+#include <sctu/task_priorities.h>
+
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#include <pico/flash.h>
+#include <pico/time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace sctu
+{
+	/** Start of every slot in flash. */
+	struct slot_header
+	{
+		uint32_t magic;
+		uint32_t sequence;
+		uint16_t version;
+		uint16_t size;
+		/// CRC-32 of the sequence and the configuration.
+		uint32_t crc;
+	};
+
+	// "SCTC", little endian
+	constexpr const uint32_t slot_magic = 0x43544353;
+
+	constexpr const size_t slot_size =
+		(sizeof(slot_header) + sizeof(stored_config) + FLASH_PAGE_SIZE - 1) /
+		FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+	constexpr const size_t store_size =
+		config_store::sectors * FLASH_SECTOR_SIZE;
+	constexpr const size_t slot_count = store_size / slot_size;
+	constexpr const uint32_t store_offset = PICO_FLASH_SIZE_BYTES - store_size;
+
+	static_assert(FLASH_SECTOR_SIZE % slot_size == 0,
+		"Slots must not straddle sectors");
+	static_assert(slot_count >= 2 * FLASH_SECTOR_SIZE / slot_size,
+		"The newest slot must survive erasing the next sector");
+
+	// Enough for a flash operation, the erase itself isn't timed
+	constexpr const uint32_t flash_timeout_ms = 100;
+
+	static const uint8_t* slot_address(size_t slot)
+	{
+		return reinterpret_cast<const uint8_t*>(
+			XIP_BASE + store_offset + slot * slot_size);
+	}
+
+	static uint32_t crc32(std::span<const uint8_t> data, uint32_t crc = 0)
+	{
+		// Bitwise, this only runs at boot and on saves
+		crc = ~crc;
+		for (uint8_t byte: data)
+		{
+			crc ^= byte;
+			for (int i = 0; i < 8; ++i)
+				crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+		}
+		return ~crc;
+	}
+
+	static uint32_t slot_crc(uint32_t sequence, const stored_config& config)
+	{
+		const uint32_t crc = crc32(std::span(
+			reinterpret_cast<const uint8_t*>(&sequence), sizeof(sequence)));
+		return crc32(std::span(
+			reinterpret_cast<const uint8_t*>(&config), sizeof(config)), crc);
+	}
+
+	// Reads a slot through XIP, returns false if it holds no configuration
+	static bool read_slot(size_t slot, slot_header& header, stored_config& config)
+	{
+		const uint8_t *address = slot_address(slot);
+		std::memcpy(&header, address, sizeof(header));
+		if (header.magic != slot_magic ||
+			header.version != stored_config::version ||
+			header.size != sizeof(stored_config))
+			return false;
+		std::memcpy(&config, address + sizeof(header), sizeof(config));
+		return slot_crc(header.sequence, config) == header.crc;
+	}
+
+	static bool blank(size_t slot)
+	{
+		const uint8_t *address = slot_address(slot);
+		return std::all_of(address, address + slot_size,
+			[](uint8_t byte) { return byte == 0xFF; });
+	}
+
+	/** A flash operation run with both cores out of XIP. */
+	struct flash_operation
+	{
+		uint32_t offset;
+		const uint8_t *data;
+		size_t size;
+	};
+
+	static void erase_sector(void *operation)
+	{
+		const auto& erase = *reinterpret_cast<const flash_operation*>(operation);
+		flash_range_erase(erase.offset, erase.size);
+	}
+
+	static void program_pages(void *operation)
+	{
+		const auto& program =
+			*reinterpret_cast<const flash_operation*>(operation);
+		flash_range_program(program.offset, program.data, program.size);
+	}
+
+	// pico_flash's FreeRTOS helper creates a task on the heap for every flash
+	// operation, and static builds have no heap. Instead, a task parked on
+	// each core takes its core out of XIP for whoever is writing from the
+	// other one, see get_flash_safety_helper() below.
+	static std::array<static_task<configMINIMAL_STACK_SIZE>, 2> lockout_tasks;
+	static std::array<TaskHandle_t, 2> lockout_handles;
+	/// Set by the parked core once its interrupts are off, and cleared once
+	/// they're back on.
+	static std::atomic_bool lockout_held = false;
+	static std::atomic_bool lockout_release = false;
+	static UBaseType_t lockout_affinity;
+	static uint32_t lockout_interrupts;
+
+	// Runs from RAM, the other core is writing to flash while this spins
+	static void __not_in_flash_func(lockout_task)(void*)
+	{
+		for (;;)
+		{
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			const uint32_t interrupts = save_and_disable_interrupts();
+			lockout_held = true;
+			__sev();
+			while (!lockout_release)
+				__wfe();
+			lockout_held = false;
+			__sev();
+			restore_interrupts(interrupts);
+		}
+	}
+
+	static bool lockout_init(bool init)
+	{
+		(void) init;
+		return true;
+	}
+
+	static int lockout_enter(uint32_t timeout_ms)
+	{
+		// Only the CLI task writes to flash, see config_store::save()
+		if (!lockout_handles[0])
+		{
+			for (size_t core = 0; core < lockout_tasks.size(); ++core)
+			{
+				lockout_handles[core] = lockout_tasks[core].create(
+					lockout_task,
+					"sctu_flash_lockout",
+					nullptr,
+					flash_lockout_task_priority,
+					1 << core);
+			}
+		}
+
+		// Stay on this core until the other one is let go, setting the
+		// affinity moves the task to it if it was elsewhere
+		lockout_affinity = vTaskCoreAffinityGet(nullptr);
+		vTaskCoreAffinitySet(nullptr, 1 << get_core_num());
+		const unsigned other = get_core_num() ^ 1;
+
+		lockout_release = false;
+		xTaskNotifyGive(lockout_handles[other]);
+		const absolute_time_t timeout = make_timeout_time_ms(timeout_ms);
+		while (!lockout_held)
+		{
+			if (time_reached(timeout))
+			{
+				// Whenever the parked task gets to run, it goes right back
+				lockout_release = true;
+				vTaskCoreAffinitySet(nullptr, lockout_affinity);
+				return PICO_ERROR_TIMEOUT;
+			}
+			taskYIELD();
+		}
+		lockout_interrupts = save_and_disable_interrupts();
+		return PICO_OK;
+	}
+
+	static int lockout_exit(uint32_t timeout_ms)
+	{
+		restore_interrupts(lockout_interrupts);
+		lockout_release = true;
+		__sev();
+		const absolute_time_t timeout = make_timeout_time_ms(timeout_ms);
+		while (lockout_held)
+		{
+			if (time_reached(timeout))
+				break;
+		}
+		vTaskCoreAffinitySet(nullptr, lockout_affinity);
+		return lockout_held ? PICO_ERROR_TIMEOUT : PICO_OK;
+	}
+
+	static flash_safety_helper_t lockout_helper {
+		.core_init_deinit = lockout_init,
+		.enter_safe_zone_timeout_ms = lockout_enter,
+		.exit_safe_zone_timeout_ms = lockout_exit,
+	};
+
+	static bool run_flash(void (*function)(void*), flash_operation operation)
+	{
+		return flash_safe_execute(function, &operation, flash_timeout_ms) ==
+			PICO_OK;
+	}
+
+	bool config_store::load(stored_config& config)
+	{
+		// Not on the init task's small stack
+		static stored_config candidate;
+		config = default_config;
+		slot_ = -1;
+		for (size_t slot = 0; slot < slot_count; ++slot)
+		{
+			slot_header header;
+			if (!read_slot(slot, header, candidate))
+				continue;
+			// Sequence numbers may wrap, compare them by distance
+			if (slot_ < 0 ||
+				static_cast<int32_t>(header.sequence - sequence_) > 0)
+			{
+				slot_ = slot;
+				sequence_ = header.sequence;
+				config = candidate;
+			}
+		}
+		return slot_ >= 0;
+	}
+
+	bool config_store::save(const stored_config& config)
+	{
+		// Only the CLI task saves, so this can be static instead of on its
+		// small stack
+		static std::array<uint8_t, slot_size> buffer;
+
+		// A slot left half written by a reset can't be programmed again,
+		// move on to the next sector then
+		size_t slot = (slot_ + 1) % slot_count;
+		const size_t slots_per_sector = FLASH_SECTOR_SIZE / slot_size;
+		if (slot % slots_per_sector && !blank(slot))
+			slot = (slot / slots_per_sector + 1) * slots_per_sector % slot_count;
+
+		if (slot % slots_per_sector == 0)
+		{
+			if (!run_flash(erase_sector, {
+					.offset = static_cast<uint32_t>(store_offset + slot * slot_size),
+					.data = nullptr,
+					.size = FLASH_SECTOR_SIZE,
+				}))
+				return false;
+			++erases_;
+		}
+
+		const uint32_t sequence = sequence_ + 1;
+		const slot_header header {
+			.magic = slot_magic,
+			.sequence = sequence,
+			.version = stored_config::version,
+			.size = sizeof(stored_config),
+			.crc = slot_crc(sequence, config),
+		};
+		buffer.fill(0xFF);
+		std::memcpy(buffer.data(), &header, sizeof(header));
+		std::memcpy(buffer.data() + sizeof(header), &config, sizeof(config));
+		if (!run_flash(program_pages, {
+				.offset = static_cast<uint32_t>(store_offset + slot * slot_size),
+				.data = buffer.data(),
+				.size = buffer.size(),
+			}))
+			return false;
+
+		if (std::memcmp(slot_address(slot), buffer.data(), buffer.size()))
+		{
+			sys_log.log(log_level::error, "config_store: slot %u reads back wrong",
+				static_cast<unsigned>(slot));
+			return false;
+		}
+		slot_ = slot;
+		sequence_ = sequence;
+		++saves_;
+		return true;
+	}
+
+	bool config_store::erase()
+	{
+		for (size_t sector = 0; sector < sectors; ++sector)
+		{
+			if (!run_flash(erase_sector, {
+					.offset = static_cast<uint32_t>(
+						store_offset + sector * FLASH_SECTOR_SIZE),
+					.data = nullptr,
+					.size = FLASH_SECTOR_SIZE,
+				}))
+				return false;
+			++erases_;
+		}
+		slot_ = -1;
+		return true;
+	}
+
+	config_store::stats config_store::get_stats() const
+	{
+		return stats {
+			.slot = slot_,
+			.sequence = sequence_,
+			.saves = saves_,
+			.erases = erases_,
+		};
+	}
+
+	bool load_settings()
+	{
+		// Not on the init task's small stack
+		static stored_config stored;
+		const bool found = settings_store.load(stored);
+
+		// Anything the CLI wouldn't have set falls back to the default
+		system_settings.autopoll_hz = !stored.autopoll_hz ||
+			(stored.autopoll_hz >= pio_controllers::min_autopoll_hz &&
+				stored.autopoll_hz <= pio_controllers::max_autopoll_hz) ?
+			stored.autopoll_hz : default_config.autopoll_hz;
+		system_settings.report_interval_ms =
+			valid_report_interval(stored.report_interval_ms) ?
+				stored.report_interval_ms : default_config.report_interval_ms;
+		system_settings.sof_sync = stored.sof_sync;
+		system_settings.sof_lead_us = std::min<uint16_t>(stored.sof_lead_us, 10000);
+		system_settings.layout = stored.layout <= hid_layout::combined ?
+			stored.layout : default_config.layout;
+		system_settings.filter_samples = std::clamp<uint8_t>(
+			stored.filter_samples, 1, max_filter_samples);
+		system_settings.filter_budget_us =
+			std::min<uint16_t>(stored.filter_budget_us, 10000);
+		input_transforms.initialize(stored.transforms);
+		return found;
+	}
+
+	bool save_settings()
+	{
+		// Only the CLI task saves, see config_store::save()
+		static stored_config stored;
+		stored.autopoll_hz = system_settings.autopoll_hz;
+		stored.report_interval_ms = system_settings.report_interval_ms;
+		stored.sof_sync = system_settings.sof_sync;
+		stored.sof_lead_us = system_settings.sof_lead_us;
+		stored.layout = system_settings.layout;
+		stored.filter_samples = system_settings.filter_samples;
+		stored.filter_budget_us = system_settings.filter_budget_us;
+		for (size_t player = 0; player < stored.transforms.size(); ++player)
+			stored.transforms[player] = input_transforms.config(player);
+		return settings_store.save(stored);
+	}
+
+	config_store settings_store;
+}
+
+extern "C"
+{
+	// Replaces the SDK's weak default, see lockout_enter()
+	flash_safety_helper_t *get_flash_safety_helper()
+	{
+		return &sctu::lockout_helper;
+	}
+}
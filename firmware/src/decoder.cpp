@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/decoder.h>
+#include <sctu/controller.h>
+
+#include <array>
+#include <cstdint>
+
+namespace sctu
+{
+	// Maps a byte to its even bits, packed into the low nibble. The odd bits
+	// are the even bits of the byte shifted right by one.
+	constexpr const auto even_bits = []
+	{
+		std::array<uint8_t, 256> table = {};
+		for (unsigned i = 0; i < table.size(); ++i)
+		{
+			table[i] = static_cast<uint8_t>(
+				((i >> 0) & 1) << 0 |
+				((i >> 2) & 1) << 1 |
+				((i >> 4) & 1) << 2 |
+				((i >> 6) & 1) << 3);
+		}
+		return table;
+	}();
+
+	// Maps the active high d-pad nibble (UP DOWN LEFT RIGHT, from bit 0) to the
+	// x axis in the low byte and the y axis in the high byte. Up and left win
+	// if both directions of an axis are pressed.
+	constexpr const auto dpad_axes = []
+	{
+		std::array<uint16_t, 16> table = {};
+		for (unsigned i = 0; i < table.size(); ++i)
+		{
+			const int8_t x = (i & 4) ? -127 : (i & 8) ? 127 : 0;
+			const int8_t y = (i & 1) ? -127 : (i & 2) ? 127 : 0;
+			table[i] = static_cast<uint16_t>(
+				static_cast<uint8_t>(x) | static_cast<uint8_t>(y) << 8);
+		}
+		return table;
+	}();
+
+	static_assert(even_bits[0b01010101] == 0xF);
+	static_assert(even_bits[0b10101010] == 0x0);
+	static_assert(dpad_axes[0b0101] == 0x8181);
+
+	bit_streams deinterleave(uint32_t data)
+	{
+		const uint32_t odd = data >> 1;
+		return bit_streams {
+			.data0 = static_cast<uint16_t>(
+				even_bits[(data >>  0) & 0xFF] <<  0 |
+				even_bits[(data >>  8) & 0xFF] <<  4 |
+				even_bits[(data >> 16) & 0xFF] <<  8 |
+				even_bits[(data >> 24) & 0xFF] << 12),
+			.data1 = static_cast<uint16_t>(
+				even_bits[(odd >>  0) & 0xFF] <<  0 |
+				even_bits[(odd >>  8) & 0xFF] <<  4 |
+				even_bits[(odd >> 16) & 0xFF] <<  8 |
+				even_bits[(odd >> 24) & 0xFF] << 12),
+		};
+	}
+
+	device_type identify(uint16_t stream)
+	{
+		// The lines are pulled down, so nothing reads as all zeros. Otherwise,
+		// the ID bits are active low like the buttons. Standard controllers
+		// release all of them, others press some, documented in clock order as
+		// 0001 for the mouse and 0100 for the NTT Data Keypad.
+		if (stream == 0)
+			return device_type::none;
+		switch (~stream >> 12 & 0xF)
+		{
+			case 0x0:
+				return device_type::gamepad;
+			case 0x8:
+				return device_type::mouse;
+			case 0x2:
+				return device_type::ntt_data_pad;
+			default:
+				return device_type::other;
+		}
+	}
+
+	controller decode_stream(uint16_t stream)
+	{
+		// Make buttons active high, leaving the ID nibble as is. A connected
+		// controller releases the ID bits, so it reads an all-ones ID
+		// before inversion.
+		const uint32_t pressed = ~stream & 0x0FFF;
+		const uint16_t axes = dpad_axes[(pressed >> 4) & 0xF];
+		return controller {
+			.connected = (stream >> 12) == 0xF,
+			.x = static_cast<int8_t>(axes & 0xFF),
+			.y = static_cast<int8_t>(axes >> 8),
+			.buttons = static_cast<uint8_t>(
+				(pressed & 0xF) | ((pressed >> 4) & 0xF0)),
+		};
+	}
+
+	controller decode(uint32_t data)
+	{
+		// Only DATA0 carries a standard controller, skip unpacking DATA1
+		const uint16_t data0 = static_cast<uint16_t>(
+			even_bits[(data >>  0) & 0xFF] <<  0 |
+			even_bits[(data >>  8) & 0xFF] <<  4 |
+			even_bits[(data >> 16) & 0xFF] <<  8 |
+			even_bits[(data >> 24) & 0xFF] << 12);
+		return decode_stream(data0);
+	}
+
+	std::array<controller, max_players> decode(
+		const std::array<uint32_t, port_count>& data)
+	{
+		std::array<controller, max_players> result;
+		for (size_t port = 0; port < port_count; ++port)
+		{
+			const bit_streams streams = deinterleave(data[port]);
+			result[port] = decode_stream(streams.data0);
+			if (port_count + port < max_players)
+				result[port_count + port] = decode_stream(streams.data1);
+		}
+		return result;
+	}
+
+	controller decode_reference(uint32_t data)
+	{
+		// Order:
+		// B Y SELECT START UP DOWN LEFT RIGHT A X L R ^ ^ ^ ^
+		// a low value signals that the button is pressed!
+		return controller {
+			.connected =
+				((data >> 24) & 1) &&
+				((data >> 26) & 1) &&
+				((data >> 28) & 1) &&
+				((data >> 30) & 1)
+			,
+			.x = static_cast<int8_t>(
+				!(data & (1 << 12)) ? -127 :
+				!(data & (1 << 14)) ?  127 : 0
+			),
+			.y = static_cast<int8_t>(
+				!(data & (1 <<  8)) ? -127 :
+				!(data & (1 << 10)) ?  127 : 0
+			),
+			.buttons = static_cast<uint8_t>(
+				(!((data >>  0) & 1)) << 0 |
+				(!((data >>  2) & 1)) << 1 |
+				(!((data >>  4) & 1)) << 2 |
+				(!((data >>  6) & 1)) << 3 |
+				(!((data >> 16) & 1)) << 4 |
+				(!((data >> 18) & 1)) << 5 |
+				(!((data >> 20) & 1)) << 6 |
+				(!((data >> 22) & 1)) << 7
+			),
+		};
+	}
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/filter.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace sctu
+{
+	uint32_t majority(std::span<const uint32_t> samples)
+	{
+		// 3 bit counter per bit position, one word per counter bit. There are
+		// at most 7 samples, so the counter never overflows.
+		uint32_t count0 = 0;
+		uint32_t count1 = 0;
+		uint32_t count2 = 0;
+		for (uint32_t sample: samples)
+		{
+			const uint32_t carry0 = count0 & sample;
+			count0 ^= sample;
+			const uint32_t carry1 = count1 & carry0;
+			count1 ^= carry0;
+			count2 |= carry1;
+		}
+
+		// A bit wins if its count is at least half the samples, rounded up
+		switch ((samples.size() + 1) / 2)
+		{
+			case 0:
+			case 1:
+				return count0 | count1 | count2;
+			case 2:
+				return count1 | count2;
+			case 3:
+				return count2 | (count1 & count0);
+			default:
+				return count2;
+		}
+	}
+
+	void sample_filter::apply(sample& raw)
+	{
+		history_[next_] = raw;
+		next_ = (next_ + 1) % history_.size();
+
+		const size_t samples = window_;
+		if (samples <= 1)
+			return;
+
+		for (size_t port = 0; port < raw.size(); ++port)
+		{
+			std::array<uint32_t, max_filter_samples> window;
+			for (size_t i = 0; i < samples; ++i)
+			{
+				const size_t index =
+					(next_ + history_.size() - 1 - i) % history_.size();
+				window[i] = history_[index][port];
+			}
+			raw[port] = majority(std::span(window.data(), samples));
+		}
+	}
+}
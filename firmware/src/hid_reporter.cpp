@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/hid_reporter.h>
+#include <sctu/boot_time.h>
+#include <sctu/latency.h>
+#include <sctu/settings.h>
+#include <sctu/sof_scheduler.h>
+#include <sctu/usb.h>
+
+#include <tusb.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace sctu
+{
+	void hid_reporter::publish(
+		const std::array<controller, max_players>& state,
+		const sample_times& times)
+	{
+		state_.publish({state, times});
+		usb_wake();
+	}
+
+	void hid_reporter::update()
+	{
+		// The host forgets everything on a reset, so start from a neutral
+		// state every time we're mounted again
+		if (!tud_mounted())
+		{
+			reported_ = {};
+			idle_rates_ = {};
+			return;
+		}
+
+		uint32_t sequence;
+		const sample latest = state_.read(&sequence);
+		const std::array<controller, max_players>& state = latest.state;
+		const bool fresh = sequence != sequence_;
+		sequence_ = sequence;
+
+		if (tud_suspended())
+		{
+			// Remote wakeup only if a button is pressed on a connected
+			// controller with an interface, and only once per sample. An
+			// empty port decodes as everything pressed, and in the fixed and
+			// combined layouts it still has an interface.
+			for (uint8_t i = 0; fresh && i < state.size(); ++i)
+			{
+				if (state[i].connected && usb_hid_instance(i) >= 0 &&
+					(state[i].x || state[i].y || state[i].buttons))
+				{
+					// Host must allow waking up from this device for this to
+					// work
+					tud_remote_wakeup();
+					break;
+				}
+			}
+			return;
+		}
+
+		// In the combined layout all controllers share one interface, so only
+		// one report goes out per host poll. Rotate which controller goes
+		// first, so a busy controller can't starve the others.
+		const TickType_t now = xTaskGetTickCount();
+		for (uint8_t n = 0; n < state.size(); ++n)
+		{
+			const uint8_t i = (first_ + n) % state.size();
+
+			// Only bother updating the tinyusb report if tinyusb is ready and
+			// the controller has an interface. In the fixed and combined
+			// layouts that includes disconnected controllers, which report a
+			// neutral state.
+			const int instance = usb_hid_instance(i);
+			if (instance < 0 || !tud_hid_n_ready(instance))
+				continue;
+
+			// Only send a report if the data has changed, or if the host
+			// asked for it to be repeated and the idle period is over
+			const report buffer = make_report(state[i]);
+			const TickType_t idle = pdMS_TO_TICKS(idle_rates_[instance] * 4u);
+			if (buffer == reported_[i] && (!idle || now - sent_[i] < idle))
+				continue;
+
+			if (tud_hid_n_report(
+				instance, usb_hid_report_id(i), buffer.data(), buffer.size()))
+			{
+				sof.report_queued(instance);
+				boot_times.mark(boot_stage::first_report);
+				// Repeats only time the host's polling, not the input path
+				if (buffer != reported_[i])
+					latency.report_queued(instance, latest.times);
+				reported_[i] = buffer;
+				sent_[i] = now;
+				first_ = (i + 1) % state.size();
+			}
+		}
+	}
+
+	void hid_reporter::set_idle(uint8_t instance, uint8_t idle_rate)
+	{
+		if (instance < idle_rates_.size())
+			idle_rates_[instance] = idle_rate;
+	}
+
+	uint16_t hid_reporter::get_report(
+		uint8_t instance, uint8_t report_id, std::span<uint8_t> buffer)
+	{
+		const int controller = usb_get_layout() == hid_layout::combined ?
+			report_id - 1 : usb_hid_controller(instance);
+		if (controller < 0 || controller >= static_cast<int>(max_players))
+			return 0;
+
+		// Always answer with the newest state, even if it hasn't been sent
+		// over the interrupt endpoint yet
+		const report result = make_report(state_.read().state[controller]);
+		const size_t length = std::min(buffer.size(), result.size());
+		std::copy_n(result.begin(), length, buffer.begin());
+		return static_cast<uint16_t>(length);
+	}
+
+	hid_reporter hid_reports;
+}
+
+// Invoked when received SET_IDLE request. TinyUSB keeps the rate to answer
+// GET_IDLE on its own.
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate)
+{
+	sctu::hid_reports.set_idle(instance, idle_rate);
+	return true;
+}
+
+// Invoked when received GET_REPORT control request
+// Application must fill buffer report's content and return its length.
+// Return zero will cause the stack to STALL request
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
+{
+	// We only have input reports
+	if (report_type != HID_REPORT_TYPE_INPUT)
+		return 0;
+	return sctu::hid_reports.get_report(
+		instance, report_id, std::span(buffer, reqlen));
+}
+
+// Invoked when received SET_REPORT control request or
+// received data on OUT endpoint ( Report ID = 0, Type = 0 )
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
+{
+	// There are no output or feature reports, so there's nothing to set
+	(void) instance;
+	(void) report_id;
+	(void) report_type;
+	(void) buffer;
+	(void) bufsize;
+}
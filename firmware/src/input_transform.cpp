@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/input_transform.h>
+
+#include <pico/time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace sctu
+{
+	int parse_buttons(std::string_view text)
+	{
+		if (text == "-")
+			return 0;
+
+		int buttons = 0;
+		while (!text.empty())
+		{
+			const size_t end = text.find('+');
+			const std::string_view name = text.substr(0, end);
+			const auto found = std::ranges::find(button_names, name);
+			if (found == button_names.end())
+				return -1;
+			buttons |= 1 << (found - button_names.begin());
+			if (end == text.npos)
+				return buttons;
+			text.remove_prefix(end + 1);
+		}
+		return -1;
+	}
+
+	std::string_view format_buttons(uint8_t buttons, std::span<char> buffer)
+	{
+		size_t length = 0;
+		auto append = [&](std::string_view text)
+		{
+			const size_t count = std::min(text.size(), buffer.size() - 1 - length);
+			std::copy_n(text.begin(), count, buffer.begin() + length);
+			length += count;
+		};
+
+		if (!buttons)
+			append("-");
+		for (size_t bit = 0; bit < button_names.size(); ++bit)
+		{
+			if (!(buttons & (1 << bit)))
+				continue;
+			if (length)
+				append("+");
+			append(button_names[bit]);
+		}
+		buffer[length] = '\0';
+		return std::string_view(buffer.data(), length);
+	}
+
+	bool transform_config::identity() const
+	{
+		const transform_config none;
+		return remap == none.remap && !turbo &&
+			!(macro_trigger && macro_length);
+	}
+
+	void input_transform::apply(
+		std::array<controller, max_players>& state, uint32_t now_us)
+	{
+		const uint8_t bank = active_.load(std::memory_order_acquire);
+		in_use_.store(bank, std::memory_order_release);
+		const int recording = recording_.load(std::memory_order_acquire);
+
+		for (size_t i = 0; i < state.size(); ++i)
+		{
+			controller& player = state[i];
+			const table& table = banks_[bank][i];
+			player_state& current = players_[i];
+			if (!player.connected)
+			{
+				current = {};
+				continue;
+			}
+
+			const uint8_t in = table.remap[player.buttons];
+			const uint8_t pressed = in & ~current.previous;
+			uint8_t out = in;
+
+			// Turbo buttons go through as soon as they're pressed, and then
+			// alternate every half period while held
+			for (uint8_t turbo = in & table.turbo; turbo; turbo &= turbo - 1)
+			{
+				const unsigned bit = std::countr_zero(turbo);
+				if (pressed & (1 << bit))
+					current.turbo_start_us[bit] = now_us;
+				if (((now_us - current.turbo_start_us[bit]) /
+						table.turbo_half_us) & 1)
+					out &= ~(1 << bit);
+			}
+
+			// Macros start when the last of their trigger buttons is
+			// pressed, and replace the trigger buttons while playing
+			if (!current.playing && table.length &&
+				(pressed & table.trigger) &&
+				(in & table.trigger) == table.trigger)
+			{
+				current.playing = true;
+				current.step = 0;
+				current.macro_start_us = now_us;
+			}
+			if (current.playing)
+			{
+				const uint32_t elapsed = now_us - current.macro_start_us;
+				while (current.step < table.length &&
+						elapsed >= table.step_end_us[current.step])
+					++current.step;
+				if (current.step < table.length)
+					out = (out & ~table.trigger) |
+						table.step_buttons[current.step];
+				else
+					current.playing = false;
+			}
+
+			if (recording == static_cast<int>(i))
+				record(in, now_us);
+			current.previous = in;
+			player.buttons = out;
+		}
+		recording_ack_.store(recording, std::memory_order_release);
+	}
+
+	void input_transform::set_config(
+		size_t player, const transform_config& config)
+	{
+		wait_for_bank();
+		configs_[player] = config;
+		const uint8_t active = active_.load(std::memory_order_relaxed);
+		auto& next = banks_[active ^ 1];
+		next = banks_[active];
+		next[player] = compile(config);
+		active_.store(active ^ 1, std::memory_order_release);
+	}
+
+	void input_transform::initialize(
+		const std::array<transform_config, max_players>& configs)
+	{
+		configs_ = configs;
+		auto& bank = banks_[active_.load(std::memory_order_relaxed)];
+		for (size_t player = 0; player < configs.size(); ++player)
+			bank[player] = compile(configs[player]);
+	}
+
+	bool input_transform::start_recording(size_t player)
+	{
+		if (recording_ >= 0)
+			return false;
+		recorded_length_ = 0;
+		recording_.store(player, std::memory_order_release);
+		return true;
+	}
+
+	size_t input_transform::stop_recording(uint8_t trigger)
+	{
+		const int player = recording_;
+		if (player < 0)
+			return 0;
+		recording_ = -1;
+		while (recording_ack_.load(std::memory_order_acquire) >= 0)
+			vTaskDelay(1);
+
+		// Every step lasts until the next one, a final release is implied by
+		// the macro ending
+		const uint32_t now_us = time_us_32();
+		size_t length = recorded_length_.load(std::memory_order_acquire);
+		if (length && !recorded_[length - 1].buttons)
+			--length;
+		transform_config config = configs_[player];
+		for (size_t i = 0; i < length; ++i)
+		{
+			const uint32_t end_us = i + 1 < length ?
+				recorded_[i + 1].start_us : now_us;
+			config.macro[i] = {
+				.buttons = recorded_[i].buttons,
+				.duration_ms = static_cast<uint16_t>(std::clamp<uint32_t>(
+					(end_us - recorded_[i].start_us) / 1000, 1, UINT16_MAX)),
+			};
+		}
+		config.macro_length = length;
+		if (trigger)
+			config.macro_trigger = trigger;
+		set_config(player, config);
+		return length;
+	}
+
+	input_transform::table input_transform::compile(
+		const transform_config& config)
+	{
+		table result;
+		for (size_t input = 0; input < result.remap.size(); ++input)
+		{
+			uint8_t output = 0;
+			for (size_t bit = 0; bit < config.remap.size(); ++bit)
+			{
+				if (input & (1 << bit))
+					output |= config.remap[bit];
+			}
+			result.remap[input] = output;
+		}
+
+		result.turbo = config.turbo;
+		result.turbo_half_us = 500000u / std::max<uint8_t>(config.turbo_hz, 1);
+		result.trigger = config.macro_trigger;
+		result.length = config.macro_trigger ?
+			std::min<size_t>(config.macro_length, max_macro_steps) : 0;
+		uint32_t end_us = 0;
+		for (size_t i = 0; i < result.length; ++i)
+		{
+			end_us += config.macro[i].duration_ms * 1000u;
+			result.step_buttons[i] = config.macro[i].buttons;
+			result.step_end_us[i] = end_us;
+		}
+		return result;
+	}
+
+	void input_transform::wait_for_bank() const
+	{
+		// The controller task picks up the newest bank on its next sample,
+		// after that the other one is free
+		while (in_use_.load(std::memory_order_acquire) !=
+				active_.load(std::memory_order_relaxed))
+			vTaskDelay(1);
+	}
+
+	void input_transform::record(uint8_t buttons, uint32_t now_us)
+	{
+		// Only changes are steps, and nothing is recorded before the first
+		// press
+		const uint8_t length = recorded_length_.load(std::memory_order_relaxed);
+		const uint8_t last = length ? recorded_[length - 1].buttons : 0;
+		if (buttons == last || length == recorded_.size())
+			return;
+		recorded_[length] = {
+			.buttons = buttons,
+			.start_us = now_us,
+		};
+		recorded_length_.store(length + 1, std::memory_order_release);
+	}
+
+	input_transform input_transforms;
+}
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/latency.h>
+
+#include <pico/time.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	static_assert(latency_histogram::bucket(latency_histogram::max_us) + 1 ==
+		latency_histogram::bucket_count);
+	static_assert(latency_histogram::bucket_floor(
+		latency_histogram::bucket(latency_histogram::max_us)) <=
+			latency_histogram::max_us);
+
+	void latency_histogram::record(uint32_t us)
+	{
+		constexpr auto relaxed = std::memory_order_relaxed;
+
+		// Odd while the histogram is being changed
+		sequence_.store(sequence_.load(relaxed) + 1, relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		if (reset_requested_.load(relaxed))
+		{
+			reset_requested_.store(false, relaxed);
+			count_.store(0, relaxed);
+			min_.store(UINT32_MAX, relaxed);
+			max_.store(0, relaxed);
+			sum_low_.store(0, relaxed);
+			sum_high_.store(0, relaxed);
+			for (auto& bucket: buckets_)
+				bucket.store(0, relaxed);
+		}
+
+		auto& bucket = buckets_[latency_histogram::bucket(us)];
+		bucket.store(bucket.load(relaxed) + 1, relaxed);
+		count_.store(count_.load(relaxed) + 1, relaxed);
+		min_.store(std::min(min_.load(relaxed), us), relaxed);
+		max_.store(std::max(max_.load(relaxed), us), relaxed);
+		const uint32_t low = sum_low_.load(relaxed) + us;
+		if (low < us)
+			sum_high_.store(sum_high_.load(relaxed) + 1, relaxed);
+		sum_low_.store(low, relaxed);
+
+		sequence_.store(sequence_.load(relaxed) + 1, std::memory_order_release);
+	}
+
+	latency_histogram::copy latency_histogram::read() const
+	{
+		constexpr auto relaxed = std::memory_order_relaxed;
+		copy result;
+		uint32_t sequence;
+		do
+		{
+			sequence = sequence_.load(std::memory_order_acquire);
+			result.count = count_.load(relaxed);
+			result.min_us = min_.load(relaxed);
+			result.max_us = max_.load(relaxed);
+			result.sum_low = sum_low_.load(relaxed);
+			result.sum_high = sum_high_.load(relaxed);
+			for (size_t i = 0; i < buckets_.size(); ++i)
+				result.buckets[i] = buckets_[i].load(relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((sequence & 1) || sequence != sequence_.load(relaxed));
+
+		// A reset that hasn't been carried out yet still counts
+		if (reset_requested_.load(relaxed))
+			result = copy {};
+		if (!result.count)
+			result.min_us = 0;
+		return result;
+	}
+
+	latency_histogram::summary latency_histogram::summarize() const
+	{
+		const copy histogram = read();
+		summary result = {
+			.count = histogram.count,
+			.min_us = histogram.min_us,
+			.average_us = 0,
+			.p99_us = 0,
+			.max_us = histogram.max_us,
+		};
+		if (!histogram.count)
+			return result;
+
+		const uint64_t sum =
+			(static_cast<uint64_t>(histogram.sum_high) << 32) | histogram.sum_low;
+		result.average_us = static_cast<uint32_t>(sum / histogram.count);
+
+		// The p99 is the top of the bucket holding it, which may be above the
+		// longest latency actually seen
+		const uint64_t rank = (static_cast<uint64_t>(histogram.count) * 99 + 99) / 100;
+		uint64_t seen = 0;
+		for (size_t i = 0; i < histogram.buckets.size(); ++i)
+		{
+			seen += histogram.buckets[i];
+			if (seen >= rank)
+			{
+				const uint32_t top = i + 1 < bucket_count ?
+					bucket_floor(i + 1) - 1 : max_us;
+				result.p99_us = std::min(top, histogram.max_us);
+				break;
+			}
+		}
+		return result;
+	}
+
+	void latency_histogram::reset()
+	{
+		reset_requested_ = true;
+	}
+
+	const char* to_string(latency_stage stage)
+	{
+		constexpr const std::array<const char*, latency_stage_count> names {
+			"trigger to ready",
+			"ready to decoded",
+			"decoded to queued",
+			"queued to complete",
+			"total",
+			"loopback",
+		};
+		const size_t index = static_cast<size_t>(stage);
+		return index < names.size() ? names[index] : "unknown";
+	}
+
+	void latency_tracker::sample_decoded(const sample_times& times)
+	{
+		histograms_[static_cast<size_t>(latency_stage::trigger_to_ready)]
+			.record(times.ready_us - times.trigger_us);
+		histograms_[static_cast<size_t>(latency_stage::ready_to_decoded)]
+			.record(times.decoded_us - times.ready_us);
+	}
+
+	void latency_tracker::report_queued(
+		uint8_t instance, const sample_times& times)
+	{
+		if (instance >= pending_.size())
+			return;
+		const uint32_t now = time_us_32();
+		histograms_[static_cast<size_t>(latency_stage::decoded_to_queued)]
+			.record(now - times.decoded_us);
+		pending_[instance] = times;
+		queued_us_[instance] = now | 1; // never 0, that's "none"
+	}
+
+	void latency_tracker::report_complete(uint8_t instance)
+	{
+		if (instance >= pending_.size() || !queued_us_[instance])
+			return;
+		const uint32_t now = time_us_32();
+		const sample_times& times = pending_[instance];
+		histograms_[static_cast<size_t>(latency_stage::queued_to_complete)]
+			.record(now - queued_us_[instance]);
+		histograms_[static_cast<size_t>(latency_stage::total)]
+			.record(now - times.trigger_us);
+		if (times.stimulus_us)
+		{
+			histograms_[static_cast<size_t>(latency_stage::loopback)]
+				.record(now - times.stimulus_us);
+		}
+		queued_us_[instance] = 0;
+	}
+
+	const latency_histogram& latency_tracker::histogram(
+		latency_stage stage) const
+	{
+		return histograms_[static_cast<size_t>(stage)];
+	}
+
+	void latency_tracker::reset()
+	{
+		for (auto& histogram: histograms_)
+			histogram.reset();
+	}
+
+	latency_tracker latency;
+}
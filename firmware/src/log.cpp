@@ -7,5 +7,5 @@
 
 namespace sctu
 {
-	safe_syslog<syslog<1024*128>> sys_log;
+	syslog<1024*8> sys_log;
 }
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/log_drain.h>
+#include <sctu/log.h>
+#include <sctu/cdc_device.h>
+#include <sctu/static_task.h>
+#include <sctu/task_priorities.h>
+
+#ifdef SCTU_LOG_UART
+#include <hardware/gpio.h>
+#include <hardware/uart.h>
+#endif
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <span>
+
+namespace sctu
+{
+	// Records pushed from interrupts don't wake the drain, so it also checks
+	// the log this often
+	constexpr const TickType_t poll_period = pdMS_TO_TICKS(100);
+
+	// How many times to retry a CDC write that makes no progress before
+	// giving up on the rest of the batch
+	constexpr const int cdc_retries = 10;
+
+	static static_task<configMINIMAL_STACK_SIZE*2> drain_task;
+
+	static void wake_drain(TaskHandle_t handle, std::string_view)
+	{
+		xTaskNotifyGive(handle);
+	}
+
+	void log_drain::initialize_task()
+	{
+#ifdef SCTU_LOG_UART
+		uart_init(uart_default, 115200);
+		gpio_set_function(PICO_DEFAULT_UART_TX_PIN, GPIO_FUNC_UART);
+#endif
+
+		// Same core as the CLI, they both share stdout's CDC connection
+		handle_ = drain_task.create(
+			task,
+			"sctu_log_drain",
+			this,
+			background_task_priority,
+			1 << 0);
+		sys_log.register_push_callback(wake_drain, handle_);
+	}
+
+	log_drain::stats log_drain::get_stats() const
+	{
+		return stats {
+			.records = records_,
+			.dropped = dropped_,
+			.sink_dropped = sink_dropped_,
+		};
+	}
+
+	void log_drain::task(void* drain)
+	{
+		log_drain& self = *reinterpret_cast<log_drain*>(drain);
+		for (;;)
+		{
+			ulTaskNotifyTake(pdTRUE, poll_period);
+			while (self.drain_batch());
+		}
+	}
+
+	void log_drain::set_binary(bool binary)
+	{
+		binary_ = binary;
+	}
+
+	bool log_drain::binary() const
+	{
+		return binary_;
+	}
+
+	void log_drain::set_cdc_muted(bool muted)
+	{
+		cdc_muted_ = muted;
+	}
+
+	bool log_drain::cdc_muted() const
+	{
+		return cdc_muted_;
+	}
+
+	bool log_drain::drain_batch()
+	{
+		size_t used = 0;
+		uint32_t records = 0;
+		const bool binary = binary_;
+		// Only take a record out of the log if it's sure to fit
+		while (batch_.size() - used >= max_line_size)
+		{
+			const std::span<char> rest = std::span(batch_).subspan(used);
+			const size_t length = binary ? copy_next(rest) : format_next(rest);
+			if (!length)
+				break;
+			used += length;
+			++records;
+		}
+
+		if (!used)
+			return false;
+
+		const std::span<const unsigned char> batch(
+			reinterpret_cast<const unsigned char*>(batch_.data()), used);
+		if (!cdc_muted_ && !write_cdc(batch))
+			sink_dropped_ += records;
+#ifdef SCTU_LOG_UART
+		// Blocks on the UART FIFO, so a slow UART holds back CDC as well, and
+		// shows up as records dropped by the log
+		uart_write_blocking(uart_default, batch.data(), batch.size());
+#endif
+		records_ += records;
+		return true;
+	}
+
+	size_t log_drain::format_next(std::span<char> batch)
+	{
+		auto entry = sys_log.read(cursor_, record_);
+		if (!entry)
+			return 0;
+
+		size_t used = 0;
+		int length = 0;
+		const uint32_t gap = entry->sequence - next_;
+		if (gap)
+		{
+			dropped_ += gap;
+			length = snprintf(batch.data(), batch.size(),
+				"syslog: %lu records dropped\r\n",
+				static_cast<unsigned long>(gap));
+			used += std::max(length, 0);
+		}
+		next_ = entry->sequence + 1;
+
+		length = snprintf(batch.data() + used, batch.size() - used,
+			"syslog: %s: %.*s\r\n", to_string(entry->level),
+			static_cast<int>(entry->text.size()), entry->text.data());
+		return used + std::max(length, 0);
+	}
+
+	size_t log_drain::copy_next(std::span<char> batch)
+	{
+		constexpr const std::array<uint8_t, 2> sync { 0xA5, 0x5A };
+		const std::span<uint8_t> bytes(
+			reinterpret_cast<uint8_t*>(batch.data()), batch.size());
+		auto record = sys_log.read_raw(cursor_, bytes.subspan(sync.size()));
+		if (!record)
+			return 0;
+		std::ranges::copy(sync, bytes.begin());
+
+		decltype(sys_log)::header head;
+		std::memcpy(&head, record->data(), sizeof(head));
+		dropped_ += head.sequence - next_;
+		next_ = head.sequence + 1;
+		return sync.size() + record->size();
+	}
+
+	bool log_drain::write_cdc(std::span<const unsigned char> batch)
+	{
+		for (int retries = 0; !batch.empty() && retries < cdc_retries;)
+		{
+			const int written = cdc.write(batch);
+			// Nobody is listening, which isn't the sink falling behind
+			if (written < 0)
+				return true;
+			batch = batch.subspan(written);
+			retries = written ? 0 : retries + 1;
+		}
+		return batch.empty();
+	}
+
+	log_drain sys_log_drain;
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/loopback.h>
+#include <sctu/board.h>
+#include <controllers.pio.h>
+
+#include <hardware/gpio.h>
+#include <hardware/pio.h>
+#include <pico/time.h>
+
+#include <cstdint>
+
+namespace sctu
+{
+	// Streams of the emulated controller, active low, B is the first bit
+	constexpr const uint32_t released_stream = 0xFFFF;
+	constexpr const uint32_t pressed_stream = 0xFFFE;
+
+	static_assert(board_pins.latch == board_pins.clk + 1,
+		"The controller emulator expects LATCH right after CLK");
+
+	bool loopback_tester::start()
+	{
+		if (active_)
+			return true;
+		if (loopback_pin < 0)
+			return false;
+
+		// pio1 may be running the followers of ports 5 and up
+		if (!pio_can_add_program(pio1, &controller_emulator_program))
+			return false;
+		sm_ = pio_claim_unused_sm(pio1, false);
+		if (sm_ < 0)
+			return false;
+		offset_ = pio_add_program(pio1, &controller_emulator_program);
+
+		pio_controller_emulator_init(
+			pio1, sm_, offset_, board_pins.clk, loopback_pin);
+		pressed_ = false;
+		pio_sm_put(pio1, sm_, released_stream);
+		pio_sm_set_enabled(pio1, sm_, true);
+
+		active_ = true;
+		return true;
+	}
+
+	void loopback_tester::stop()
+	{
+		if (!active_)
+			return;
+		active_ = false;
+
+		pio_sm_set_enabled(pio1, sm_, false);
+		pio_remove_program(pio1, &controller_emulator_program, offset_);
+		pio_sm_unclaim(pio1, sm_);
+		sm_ = -1;
+		// Back to a plain input, like the port's own pins
+		gpio_init(loopback_pin);
+	}
+
+	void loopback_tester::set_pressed(bool pressed)
+	{
+		if (!active_)
+			return;
+
+		// Stamp the change before it can reach the bus, so it's never timed
+		// short. The controller task reads these in the opposite order.
+		pressed_ = pressed;
+		changed_us_ = time_us_32() | 1;
+
+		// Drop any pattern the bus hasn't picked up yet, only the newest
+		// counts
+		pio_sm_clear_fifos(pio1, sm_);
+		pio_sm_put(pio1, sm_, pressed ? pressed_stream : released_stream);
+	}
+
+	loopback_tester loopback;
+}
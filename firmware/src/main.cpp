@@ -3,14 +3,32 @@
 /// @file
 
 #include <sctu/log.h>
+#include <sctu/log_drain.h>
 #include <sctu/usb.h>
 #include <sctu/cli_task.h>
 #include <sctu/watchdog.h>
 #include <sctu/cdc_device.h>
 #include <sctu/controller.h>
 #include <sctu/pio_controllers.h>
+#include <sctu/board.h>
+#include <sctu/decoder.h>
+#include <sctu/filter.h>
+#include <sctu/settings.h>
+#include <sctu/sof_scheduler.h>
+#include <sctu/hid_reporter.h>
+#include <sctu/latency.h>
+#include <sctu/loopback.h>
+#include <sctu/capture.h>
+#include <sctu/input_transform.h>
+#include <sctu/config_store.h>
+#include <sctu/boot_time.h>
+#include <sctu/power.h>
+#include <sctu/task_priorities.h>
+#include <sctu/static_task.h>
+#include <sctu/allocation.h>
 
 #include <hardware/structs/mpu.h>
+#include <pico/time.h>
 
 #include <tusb_config.h>
 #include <tusb.h>
@@ -20,86 +38,314 @@
 #include <queue.h>
 #include <task.h>
 
+#include <algorithm>
+#include <array>
 #include <cstdio>
 
 using sctu::sys_log;
 
-static void print_callback(std::string_view str)
+// Logs whenever the kind of device on any DATA0 or DATA1 line changes
+static void log_devices(
+	const std::array<uint32_t, sctu::port_count>& raw,
+	std::array<sctu::device_type, 2 * sctu::port_count>& devices)
 {
-	printf("syslog: %.*s\r\n", str.size(), str.data());
+	constexpr const std::array<const char*, 5> names {
+		"none", "gamepad", "mouse", "ntt data pad", "other" };
+	for (size_t port = 0; port < raw.size(); ++port)
+	{
+		const sctu::bit_streams streams = sctu::deinterleave(raw[port]);
+		const std::array<uint16_t, 2> data { streams.data0, streams.data1 };
+		for (size_t line = 0; line < data.size(); ++line)
+		{
+			const sctu::device_type type = sctu::identify(data[line]);
+			auto& device = devices[line * sctu::port_count + port];
+			if (device == type)
+				continue;
+			device = type;
+
+			sys_log.log(sctu::log_level::info, "port %u data%u: %s",
+				static_cast<unsigned>(port + 1), static_cast<unsigned>(line),
+				names[static_cast<size_t>(type)]);
+		}
+	}
 }
 
-constexpr const std::array<int, 4> led_gpios { 14, 15, 16, 17 };
+// Lights each LED if any player on its ports is connected
+static void update_leds(const std::array<sctu::controller, sctu::max_players>& state)
+{
+	for (size_t led = 0; led < sctu::led_gpios.size(); ++led)
+	{
+		bool lit = false;
+		for (size_t player = 0; player < state.size(); ++player)
+		{
+			if (player % sctu::port_count % sctu::led_gpios.size() == led)
+				lit = lit || state[player].connected;
+		}
+		gpio_put(sctu::led_gpios[led], lit);
+	}
+}
 
-// FreeRTOS task to handle polling controller and sending HID reports
+// Whether any connected player is pressing anything
+static bool any_pressed(const std::array<sctu::controller, sctu::max_players>& state)
+{
+	return std::ranges::any_of(state, [](const sctu::controller& player)
+	{
+		return player.connected && (player.x || player.y || player.buttons);
+	});
+}
+
+// While the bus is suspended, sample just often enough to notice a press to
+// wake the host with
+constexpr const TickType_t wake_scan_period = pdMS_TO_TICKS(50);
+// After a press, sample at full rate for this long waiting for the host to
+// resume, in case it does
+constexpr const TickType_t wake_grace = pdMS_TO_TICKS(1000);
+
+// A sample may wait on the bus for a couple of ticks on top of its period,
+// see pio_controllers::poll(), and the SOF wait can time out before that
+constexpr const uint32_t sample_slack_us = 5000;
+
+// The USB task is woken up by every sample, so it should never be quiet for
+// longer than the slowest sample period, the wake scan
+constexpr const uint32_t usb_deadline_us = 200000;
+
+// FreeRTOS task to handle polling controllers. It never touches TinyUSB, the
+// USB task sends the HID reports.
 static void hid_task(void*)
 {
 	TickType_t last = xTaskGetTickCount();
-	sctu::pio_controllers controllers(pio0);
+	sctu::pio_controllers controllers(sctu::board_pins);
 
 	// Initialize LED GPIOs
-	for (int led: led_gpios)
+	for (int led: sctu::led_gpios)
 	{
 		gpio_init(led);
 		gpio_set_dir(led, true);
 	}
 
-	std::array<sctu::controller, 4> last_state = {};
+	sctu::sof.attach(&controllers);
+
+	// Sample once before USB starts, so the first enumeration already has
+	// an interface for every connected controller, instead of re-enumerating
+	// right after it. The filter has no history yet, so leave it out.
+	controllers.set_filter(1);
+	uint8_t probed = 0;
+	const auto initial = controllers.poll();
+	for (size_t i = 0; i < initial.size(); ++i)
+		probed |= initial[i].connected << i;
+	usb_set_probed_controllers(probed);
+	sctu::boot_times.mark(sctu::boot_stage::controllers_probed);
+
+	// The heartbeat only beats when a new sample lands, so a stalled state
+	// machine, which poll() and latest() paper over with the previous
+	// sample, misses its deadline and gets the state machines restarted
+	// before the board is given up on
+	const int heartbeat = sctu::supervisor.add("sctu_controller",
+		2 * sctu::system_settings.report_interval_ms * 1000u + sample_slack_us,
+		[&controllers]() { controllers.recover(); });
+
+	std::array<sctu::controller, sctu::max_players> last_state = {};
+	std::array<sctu::controller, sctu::max_players> replayed = {};
+	std::array<sctu::device_type, 2 * sctu::port_count> devices = {};
+	unsigned autopoll_hz = 0;
+	uint32_t last_ready_us = 0;
+	uint32_t last_beat_ready_us = 0;
+	uint32_t last_stimulus_us = 0;
+	bool low_power = false;
+	bool waking = false;
+	TickType_t wake_start = 0;
+	usb_set_power_listener(xTaskGetCurrentTaskHandle());
 	for (;;)
 	{
-		vTaskDelayUntil(&last, pdMS_TO_TICKS(10));
-		const std::array<sctu::controller, 4> state = controllers.poll();
-		// Keep track of the number of controllers configured, used to index
-		// tinyusb devices
-		uint8_t controller_ready = 0;
-		for (uint8_t i = 0; i < 4; ++i)
+		// Suspending the bus switches to a slow scan, with the clocks slowed
+		// down and the LEDs off, until the host resumes or a press wakes it
+		if (!usb_suspended())
+			waking = false;
+		const bool suspended = usb_suspended() &&
+			!(waking && xTaskGetTickCount() - wake_start < wake_grace);
+		if (suspended != low_power)
 		{
-			// Update USB controller state if there's a change
-			if (last_state[i].connected != state[i].connected)
+			low_power = suspended;
+			if (low_power)
 			{
-				if (state[i].connected)
-					usb_enable_controller(1 << i);
-				else
-					usb_disable_controller(1 << i);
-				gpio_put(led_gpios[i], state[i].connected);
+				waking = false;
+				update_leds({});
+				sctu::power.enter_low_power();
+			}
+			else
+			{
+				sctu::power.exit_low_power();
+				update_leds(last_state);
+				last = xTaskGetTickCount();
 			}
+		}
+
+		// Sample at the same rate the host polls the HID endpoints, so each
+		// IN poll finds one fresh report. USB configuration changes are
+		// only scheduled here, they never block sampling.
+		const uint8_t interval = sctu::system_settings.report_interval_ms;
+		usb_set_report_interval(interval);
+		usb_set_layout(sctu::system_settings.layout);
 
-			// Only bother updating the tinyusb report if tinyusb is ready and
-			// we're connected.
-			if (state[i].connected && tud_hid_n_ready(controller_ready))
+		// Apply sampling mode changes requested by other tasks, autopoll
+		// stays off in low power mode
+		const unsigned requested_hz =
+			low_power ? 0 : sctu::system_settings.autopoll_hz.load();
+		if (requested_hz != autopoll_hz)
+		{
+			if (requested_hz)
+				controllers.start_autopoll(requested_hz);
+			else
+				controllers.stop_autopoll();
+			autopoll_hz = requested_hz;
+		}
+
+		// The filter delays edges by half its window, so only use as much of
+		// it as the latency budget allows at the current sample rate
+		const unsigned period_us =
+			low_power ? wake_scan_period * portTICK_PERIOD_MS * 1000u :
+			autopoll_hz ? 1000000u / autopoll_hz : interval * 1000u;
+		controllers.set_filter(sctu::filter_samples(
+			sctu::system_settings.filter_samples,
+			period_us,
+			sctu::system_settings.filter_budget_us));
+
+		// This loop runs once per report interval, and picks up a new sample
+		// every time unless autopoll samples less often than that
+		const uint32_t loop_us = low_power ?
+			wake_scan_period * portTICK_PERIOD_MS * 1000u : interval * 1000u;
+		sctu::supervisor.set_deadline(heartbeat,
+			2 * std::max<uint32_t>(loop_us, period_us) + sample_slack_us);
+
+		std::array<sctu::controller, sctu::max_players> state;
+		sctu::sample_times times;
+		if (low_power)
+		{
+			// A resume or suspend notifies us, so this ends early when the
+			// host resumes the bus
+			ulTaskNotifyTake(pdTRUE, wake_scan_period);
+			state = controllers.poll(&times);
+			last = xTaskGetTickCount();
+			if (any_pressed(state))
 			{
-				// Remote wakeup only if it's suspended, and a button is pressed
-				if (tud_suspended() && (state[i].x || state[i].y || state[i].buttons))
-				{
-					// Host must allow waking up from this device for this to work
-					tud_remote_wakeup();
-				}
+				// Full rate from the next sample on, the USB task wakes the
+				// host up with this one
+				waking = true;
+				wake_start = last;
+			}
+		}
+		else if (autopoll_hz)
+		{
+			// In autopoll mode the hub is always sampling, so just grab the
+			// newest state instead of waiting on the bus
+			vTaskDelayUntil(&last, pdMS_TO_TICKS(interval));
+			state = controllers.latest(&times);
+		}
+		else if (sctu::system_settings.sof_sync &&
+			controllers.wait(pdMS_TO_TICKS(interval) + 2))
+		{
+			// The SOF scheduler latched the hub just ahead of the next IN
+			// token. Without SOFs (e.g. suspended) the wait times out and we
+			// fall back to sampling on our own.
+			state = controllers.latest(&times);
+			last = xTaskGetTickCount();
+		}
+		else
+		{
+			vTaskDelayUntil(&last, pdMS_TO_TICKS(interval));
+			state = controllers.poll(&times);
+		}
 
-				// Only send a report if the data has changed
-				else if (last_state[i] != state[i])
+		// Only a sample that actually landed counts as progress
+		if (times.ready_us != last_beat_ready_us)
+		{
+			sctu::supervisor.beat(heartbeat);
+			last_beat_ready_us = times.ready_us;
+		}
+
+		// A replay from the CLI stands in for the hub, keeping the newest
+		// replayed state between records, see capture.h
+		const bool replaying = sctu::replay.active();
+		if (replaying)
+		{
+			sctu::sample_filter::sample raw;
+			if (sctu::replay.next(controllers.filter(), raw))
+				replayed = sctu::decode(raw);
+			state = replayed;
+		}
+		else
+		{
+			replayed = {};
+		}
+		times.decoded_us = time_us_32();
+		times.stimulus_us = 0;
+
+		// A timed out poll, or a slow autopoll rate, hands back the same
+		// sample again, only time it once. Replayed samples weren't timed.
+		if (times.ready_us != last_ready_us && !replaying)
+		{
+			sctu::latency.sample_decoded(times);
+			last_ready_us = times.ready_us;
+		}
+
+		// Tag the first sample showing the loopback tester's newest change
+		const uint32_t stimulus_us = sctu::loopback.changed_us();
+		if (sctu::loopback.active() && stimulus_us != last_stimulus_us)
+		{
+			const bool pressed = sctu::loopback.pressed();
+			for (size_t i = 0; i < state.size(); ++i)
+			{
+				const bool b = state[i].buttons & 1;
+				if (state[i].connected && b == pressed &&
+					(last_state[i].buttons & 1) != b)
 				{
-					// Our report only has 3 bytes, don't assume the struct with the data has
-					// no padding, and don't use the no padding directive for structs-- last
-					// thing I want to deal with is misaligned data access on ARM
-					uint8_t buffer[3];
-					buffer[0] = state[i].x;
-					buffer[1] = state[i].y;
-					buffer[2] = state[i].buttons;
-					tud_hid_n_report(controller_ready, 0, &buffer, sizeof(buffer));
+					times.stimulus_us = stimulus_us;
+					last_stimulus_us = stimulus_us;
+					break;
 				}
-				controller_ready++;
+			}
+		}
+
+		// Turbo, remapping and macros only change what the host sees, the
+		// rest of the loop works on the buttons as pressed
+		std::array<sctu::controller, sctu::max_players> reported = state;
+		sctu::input_transforms.apply(reported, times.decoded_us);
+
+		// Hand the sample off to the USB task, which sends the reports
+		sctu::hid_reports.publish(reported, times);
+
+		log_devices(controllers.latest_raw(), devices);
+
+		bool connections_changed = false;
+		for (uint8_t i = 0; i < sctu::max_players; ++i)
+		{
+			// Update USB controller state if there's a change
+			if (last_state[i].connected != state[i].connected)
+			{
+				if (state[i].connected)
+					usb_enable_controller(1 << i);
+				else
+					usb_disable_controller(1 << i);
+				connections_changed = true;
 			}
 			last_state[i] = state[i];
 		}
+		if (!low_power && connections_changed)
+			update_leds(state);
 	}
 }
 
 // FreeRTOS task to handle USB tasks
 static void usb_device_task(void*)
 {
-	tusb_init();
+	usb_initialize();
+	const int heartbeat = sctu::supervisor.add("sctu_usb", usb_deadline_us);
 	for(;;)
 	{
+		sctu::supervisor.beat(heartbeat);
+		// This blocks until TinyUSB has an event to process, which includes
+		// other tasks waking us up through usb_wake(), so everything below
+		// runs after every event.
 		tud_task();
 		// tud_cdc_connected() must be called in the same task as tud_task, as
 		// an internal data structure is shared without locking between both
@@ -107,7 +353,9 @@ static void usb_device_task(void*)
 		// As a workaround, use an atomic variable to get the result of this
 		// function, and read from it elsewhere
 		sctu::cdc.update();
-		taskYIELD();
+		sctu::sof.update();
+		usb_service();
+		sctu::hid_reports.update();
 	}
 }
 
@@ -122,75 +370,71 @@ static void initialize_mpu()
 		| 0x10000000; // Disable instruction fetch, disallow all
 }
 
-static void init_cpu_task(void* val)
-{
-	std::atomic_bool *cpu_init = reinterpret_cast<std::atomic_bool*>(val);
-	initialize_mpu();
-	*cpu_init = true;
-	vTaskDelete(nullptr);
-	for(;;);
-}
+// Every task's stack and control block, none of them come from the heap
+static sctu::static_task<configMINIMAL_STACK_SIZE> init_stack;
+static sctu::static_task<configMINIMAL_STACK_SIZE*2> usb_stack;
+static sctu::static_task<configMINIMAL_STACK_SIZE> controller_stack;
+static sctu::static_task<configMINIMAL_STACK_SIZE*2> cli_stack;
 
 static void init_task(void*)
 {
-	std::array<std::atomic_bool, 2> cpu_init = {};
-	xTaskCreateAffinitySet(
-		init_cpu_task,
-		"sctu_cpu0_init",
-		configMINIMAL_STACK_SIZE,
-		&cpu_init[0],
-		tskIDLE_PRIORITY+1,
-		1 << 0,
-		nullptr);
-
-	xTaskCreateAffinitySet(
-		init_cpu_task,
-		"sctu_cpu1_init",
-		configMINIMAL_STACK_SIZE,
-		&cpu_init[1],
-		tskIDLE_PRIORITY+1,
-		1 << 1,
-		nullptr);
-
-	// Wait until CPU init tasks are done
-	while(!cpu_init[0] || !cpu_init[1])
+	sctu::boot_times.mark(sctu::boot_stage::init_task);
+
+	// The MPU is per core, so move this task to each core in turn to set it
+	// up there. Changing the affinity of the running task switches cores
+	// before returning.
+	for (UBaseType_t core = 0; core < configNUMBER_OF_CORES; ++core)
 	{
-		taskYIELD();
+		vTaskCoreAffinitySet(nullptr, 1 << core);
+		initialize_mpu();
 	}
+	vTaskCoreAffinitySet(nullptr, (1 << 0) | (1 << 1));
+	sctu::boot_times.mark(sctu::boot_stage::mpu_ready);
+	sctu::power.initialize();
+
+	// Settings only come from flash once, before anything that uses them
+	// starts, so the host enumerates the stored configuration right away
+	if (!sctu::load_settings())
+		sctu::sys_log.log(sctu::log_level::info,
+			"config_store: nothing stored, using defaults");
+	sctu::boot_times.mark(sctu::boot_stage::settings_loaded);
 
 	// We're not calling board_init() since for our configuration, all it is
 	// really doing is initializing UART, which... we're not using at all.
-	sctu::initialize_watchdog_tasks();
-	sys_log.register_push_callback(print_callback);
+	sctu::supervisor.initialize_tasks();
+	sctu::cdc.initialize();
+	sctu::sys_log_drain.initialize_task();
+	sctu::capture.initialize_task();
+
+	usb_initialize_reenumeration_task();
 
 	// Anything USB related needs to be on the same core-- just use core 2
-	xTaskCreateAffinitySet(
+	usb_stack.create(
 		usb_device_task,
 		"sctu_usb",
-		configMINIMAL_STACK_SIZE*2,
 		nullptr,
-		tskIDLE_PRIORITY+1,
-		1 << 1,
-		nullptr);
+		sctu::usb_task_priority,
+		1 << 1);
 
-	xTaskCreateAffinitySet(
+	// Sampling only hands data off to the USB task, so it can run on the
+	// other core, in parallel with USB servicing
+	controller_stack.create(
 		hid_task,
 		"sctu_controller",
-		configMINIMAL_STACK_SIZE,
 		nullptr,
-		tskIDLE_PRIORITY+1,
-		1 << 1,
-		nullptr);
+		sctu::controller_task_priority,
+		1 << 0);
 
 	// CLI doesn't need to be in the same core as USB...
-	xTaskCreateAffinitySet(
+	cli_stack.create(
 		sctu::cli_task,
 		"sctu_cli",
-		configMINIMAL_STACK_SIZE*2,
 		nullptr,
-		tskIDLE_PRIORITY+1,
-		1 << 0,
-		nullptr);
+		sctu::background_task_priority,
+		1 << 0);
+
+	// Everything that needed memory has it now, see allocation.h
+	sctu::seal_allocations();
 
 	// ...and kill this init task as it's done.
 	vTaskDelete(nullptr);
@@ -202,14 +446,12 @@ int main()
 	// Alright, based on reading the pico-sdk, it's pretty much just a bad idea
 	// to do ANYTHING outside of a FreeRTOS task when using FreeRTOS with the
 	// pico-sdk... just do all required initialization in the init task
-	xTaskCreateAffinitySet(
+	init_stack.create(
 		init_task,
 		"sctu_init",
-		configMINIMAL_STACK_SIZE,
 		nullptr,
-		tskIDLE_PRIORITY+1,
-		(1 << 0) | (1 << 1),
-		nullptr);
+		sctu::background_task_priority,
+		(1 << 0) | (1 << 1));
 
 	vTaskStartScheduler();
 	for(;;);
@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/pio_controllers.h>
+#include <sctu/capture.h>
+#include <sctu/decoder.h>
+#include <sctu/log.h>
+
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/clocks.h>
+#include <pico/time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sctu
+{
+	// Clock divider matching the timing documented in controllers.pio, and
+	// one matching the console's own, twice as fast, bus timing.
+	constexpr const float default_divider = 100.0f;
+	constexpr const float fast_divider = 50.0f;
+
+	// PIO cycles taken by one sample: pull and irq, 30 cycles of latch and
+	// counter setup, and 30 cycles per bit.
+	constexpr const unsigned sample_cycles = 2 + 30 + 16 * 30;
+
+	pio_controllers* pio_controllers::instance_ = nullptr;
+
+	pio_controllers::pio_controllers(const pin_map& pins)
+	{
+		// Chain one channel per state machine, so a single trigger collects
+		// all words. Only the last channel needs to interrupt, as by then
+		// every other word has already landed.
+		for (auto& channel: dma_channels_)
+			channel = dma_claim_unused_channel(true);
+
+		for (size_t i = 0; i < dma_channels_.size(); ++i)
+		{
+			dma_channel_config config =
+				dma_channel_get_default_config(dma_channels_[i]);
+			channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+			channel_config_set_read_increment(&config, false);
+			channel_config_set_write_increment(&config, false);
+			channel_config_set_dreq(&config,
+				pio_get_dreq(block(i), state_machine(i), false));
+			if (i + 1 < dma_channels_.size())
+				channel_config_set_chain_to(&config, dma_channels_[i + 1]);
+
+			dma_channel_configure(
+				dma_channels_[i],
+				&config,
+				&raw_[1][i],
+				&block(i)->rxf[state_machine(i)],
+				1,
+				false);
+		}
+
+		instance_ = this;
+		dma_channel_set_irq0_enabled(dma_channels_.back(), true);
+		irq_add_shared_handler(
+			DMA_IRQ_0,
+			dma_handler,
+			PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+		irq_set_enabled(DMA_IRQ_0, true);
+
+		primary_offset_ = pio_add_program(pio0, &controller0_program);
+		secondary_offset_ = pio_add_program(pio0, &controllers1_3_program);
+		pio_controller0_init(pio0, 0, primary_offset_, pins.clk, pins.latch,
+			pins.data[0], default_divider);
+		for (size_t port = 1; port < std::min(port_count, ports_per_block); ++port)
+		{
+			pio_controllers1_3_init(
+				pio0, port, secondary_offset_, pins.data[port], default_divider);
+		}
+
+		// The followers only wait on LATCH, so they can start first, and the
+		// primary block must start in sync so irq 4 reaches every machine
+		if constexpr (port_count > ports_per_block)
+		{
+			follower_offset_ =
+				pio_add_program(pio1, &controller_follower_program);
+			for (size_t port = ports_per_block; port < port_count; ++port)
+			{
+				pio_controller_follower_init(
+					pio1,
+					state_machine(port),
+					follower_offset_,
+					pins.latch,
+					pins.data[port],
+					default_divider);
+			}
+			pio_enable_sm_mask_in_sync(pio1, block_mask(pio1));
+		}
+		pio_enable_sm_mask_in_sync(pio0, block_mask(pio0));
+	}
+
+	pio_controllers::~pio_controllers()
+	{
+		if (autopoll_)
+			stop_autopoll();
+		dma_channel_set_irq0_enabled(dma_channels_.back(), false);
+		irq_remove_handler(DMA_IRQ_0, dma_handler);
+		for (auto channel: dma_channels_)
+		{
+			dma_channel_abort(channel);
+			dma_channel_unclaim(channel);
+		}
+		instance_ = nullptr;
+	}
+
+	void pio_controllers::arm()
+	{
+		// Chained channels are triggered by their predecessor, so only the
+		// head of the chain needs to be started. The transfer count reloads
+		// on every trigger.
+		dma_channel_start(dma_channels_.front());
+	}
+
+	void pio_controllers::retarget(size_t buffer)
+	{
+		for (size_t i = 0; i < dma_channels_.size(); ++i)
+			dma_channel_set_write_addr(dma_channels_[i], &raw_[buffer][i], false);
+	}
+
+	uint32_t pio_controllers::block_mask(PIO pio)
+	{
+		uint32_t mask = 0;
+		for (size_t port = 0; port < port_count; ++port)
+		{
+			if (block(port) == pio)
+				mask |= 1u << state_machine(port);
+		}
+		return mask;
+	}
+
+	void pio_controllers::set_clock_divider(float divider)
+	{
+		// Both blocks must run at the same rate, the followers time their
+		// samples in cycles from LATCH
+		for (size_t port = 0; port < port_count; ++port)
+			pio_sm_set_clkdiv(block(port), state_machine(port), divider);
+		pio_clkdiv_restart_sm_mask(pio0, block_mask(pio0));
+		if constexpr (port_count > ports_per_block)
+			pio_clkdiv_restart_sm_mask(pio1, block_mask(pio1));
+	}
+
+	void pio_controllers::trigger()
+	{
+		// If a request is already queued, the next sample starts as soon as
+		// the current one is done anyway, don't let requests pile up.
+		if (pio_sm_is_tx_fifo_empty(pio0, 0))
+		{
+			trigger_us_.store(time_us_32(), std::memory_order_relaxed);
+			pio_sm_put(pio0, 0, 0);
+		}
+	}
+
+	bool pio_controllers::autopoll_callback(repeating_timer_t *timer)
+	{
+		auto *self = reinterpret_cast<pio_controllers*>(timer->user_data);
+		self->trigger();
+		return true;
+	}
+
+	void pio_controllers::start_autopoll(unsigned rate_hz)
+	{
+		if (autopoll_)
+			stop_autopoll();
+
+		rate_hz = std::clamp(rate_hz, min_autopoll_hz, max_autopoll_hz);
+		const uint32_t period_us = 1000000u / rate_hz;
+
+		// Leave the bus idle for at least a quarter of a sample between
+		// latches, otherwise use the faster console timing.
+		const uint32_t sample_us = static_cast<uint32_t>(
+			sample_cycles * default_divider / (clock_get_hz(clk_sys) / 1e6f));
+		set_clock_divider(
+			period_us < sample_us + sample_us / 4 ?
+				fast_divider : default_divider);
+
+		autopoll_ = true;
+		arm();
+		add_repeating_timer_us(
+			-static_cast<int64_t>(period_us), autopoll_callback, this, &timer_);
+	}
+
+	void pio_controllers::stop_autopoll()
+	{
+		// Stop re-arming first, then let any sample in flight finish before
+		// tearing down the chain.
+		autopoll_ = false;
+		cancel_repeating_timer(&timer_);
+		vTaskDelay(pdMS_TO_TICKS(2) + 1);
+		reset();
+		retarget((sequence_ + 1) & 1);
+		set_clock_divider(default_divider);
+	}
+
+	std::array<controller, max_players> pio_controllers::latest(
+		sample_times *times) const
+	{
+		return decode(latest_raw(times));
+	}
+
+	std::array<uint32_t, port_count> pio_controllers::latest_raw(
+		sample_times *times) const
+	{
+		// The DMA chain only writes to the front buffer after two more
+		// samples are published, so the copy is good if the sequence did not
+		// move while copying.
+		std::array<uint32_t, port_count> raw;
+		sample_times sample;
+		uint32_t sequence;
+		do
+		{
+			sequence = sequence_;
+			raw = raw_[sequence & 1];
+			sample = times_[sequence & 1];
+		} while (sequence != sequence_);
+
+		if (times)
+			*times = sample;
+		return raw;
+	}
+
+	void pio_controllers::reset()
+	{
+		for (auto channel: dma_channels_)
+			dma_channel_abort(channel);
+		for (size_t port = 0; port < port_count; ++port)
+			pio_sm_clear_fifos(block(port), state_machine(port));
+	}
+
+	void pio_controllers::recover()
+	{
+		// Stop both blocks where they are, and send every state machine back
+		// to the start of its program with a clean slate. The primary may
+		// have stalled with LATCH still up.
+		pio_set_sm_mask_enabled(pio0, block_mask(pio0), false);
+		if constexpr (port_count > ports_per_block)
+			pio_set_sm_mask_enabled(pio1, block_mask(pio1), false);
+		reset();
+		pio_interrupt_clear(pio0, 4);
+		for (size_t port = 0; port < port_count; ++port)
+		{
+			const uint offset = block(port) == pio1 ? follower_offset_ :
+				port ? secondary_offset_ : primary_offset_;
+			pio_sm_restart(block(port), state_machine(port));
+			pio_sm_exec(block(port), state_machine(port), pio_encode_jmp(offset));
+		}
+		pio_sm_exec(pio0, 0, pio_encode_set(pio_pins, 0));
+
+		// Same order as at construction, see pio_controllers()
+		retarget((sequence_ + 1) & 1);
+		if constexpr (port_count > ports_per_block)
+		{
+			pio_clkdiv_restart_sm_mask(pio1, block_mask(pio1));
+			pio_enable_sm_mask_in_sync(pio1, block_mask(pio1));
+		}
+		pio_clkdiv_restart_sm_mask(pio0, block_mask(pio0));
+		pio_enable_sm_mask_in_sync(pio0, block_mask(pio0));
+		if (autopoll_)
+			arm();
+
+		if (TaskHandle_t task = listener_)
+			xTaskNotifyGive(task);
+	}
+
+	void pio_controllers::set_filter(unsigned samples)
+	{
+		filter_.set_window(samples);
+	}
+
+	void pio_controllers::dma_handler()
+	{
+		pio_controllers *self = instance_;
+		if (!self)
+			return;
+
+		const uint channel = self->dma_channels_.back();
+		if (!dma_channel_get_irq0_status(channel))
+			return;
+		dma_channel_acknowledge_irq0(channel);
+
+		// Publish the back buffer, and point the chain at the old front one.
+		// Only this handler writes the sequence.
+		const uint32_t sequence = self->sequence_ + 1;
+		if (capture.active())
+			capture.record(time_us_32(), self->raw_[sequence & 1]);
+		self->filter_.apply(self->raw_[sequence & 1]);
+		self->times_[sequence & 1] = {
+			.trigger_us = self->trigger_us_.load(std::memory_order_relaxed),
+			.ready_us = time_us_32(),
+			.decoded_us = 0,
+			.stimulus_us = 0,
+		};
+		self->sequence_ = sequence;
+		self->retarget((sequence + 1) & 1);
+		if (self->autopoll_)
+			self->arm();
+
+		BaseType_t woken = pdFALSE;
+		TaskHandle_t task = self->listener_;
+		if (task)
+			vTaskNotifyGiveFromISR(task, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
+
+	void pio_controllers::start()
+	{
+		if (autopoll_)
+			return;
+		arm();
+		trigger();
+	}
+
+	bool pio_controllers::wait(TickType_t timeout)
+	{
+		listener_ = xTaskGetCurrentTaskHandle();
+		return ulTaskNotifyTake(pdTRUE, timeout);
+	}
+
+	std::array<controller, max_players> pio_controllers::poll(
+		sample_times *times)
+	{
+		// Drop any stale notification, so we only wake up for this sample
+		listener_ = xTaskGetCurrentTaskHandle();
+		ulTaskNotifyTake(pdTRUE, 0);
+		start();
+
+		// A full transaction takes around 400us, so anything past a couple of
+		// ticks means a state machine is stuck.
+		if (!wait(pdMS_TO_TICKS(2) + 1))
+		{
+			if (!autopoll_)
+				reset();
+			sys_log.log(log_level::warning, "pio_controllers: sample timed out");
+		}
+
+		return latest(times);
+	}
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/power.h>
+
+#include <hardware/address_mapped.h>
+#include <hardware/clocks.h>
+#include <hardware/pll.h>
+#include <hardware/structs/clocks.h>
+#include <hardware/structs/systick.h>
+#ifdef SCTU_LOG_UART
+#include <hardware/uart.h>
+#endif
+#include <pico/time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <cstdint>
+
+namespace sctu
+{
+	// Clocks of blocks nothing in the firmware uses. Gating a block's clock
+	// while it's held in reset saves a little, and costs nothing.
+	constexpr const uint32_t unused_clocks0 =
+		CLOCKS_WAKE_EN0_CLK_SYS_SPI1_BITS |
+		CLOCKS_WAKE_EN0_CLK_PERI_SPI1_BITS |
+		CLOCKS_WAKE_EN0_CLK_SYS_SPI0_BITS |
+		CLOCKS_WAKE_EN0_CLK_PERI_SPI0_BITS |
+		CLOCKS_WAKE_EN0_CLK_SYS_RTC_BITS |
+		CLOCKS_WAKE_EN0_CLK_RTC_RTC_BITS |
+		CLOCKS_WAKE_EN0_CLK_SYS_PWM_BITS |
+		CLOCKS_WAKE_EN0_CLK_SYS_I2C1_BITS |
+		CLOCKS_WAKE_EN0_CLK_SYS_I2C0_BITS |
+		CLOCKS_WAKE_EN0_CLK_SYS_ADC_BITS |
+		CLOCKS_WAKE_EN0_CLK_ADC_ADC_BITS;
+
+#ifdef SCTU_LOG_UART
+	constexpr const uint32_t unused_clocks1 = 0;
+#else
+	constexpr const uint32_t unused_clocks1 =
+		CLOCKS_WAKE_EN1_CLK_SYS_UART1_BITS |
+		CLOCKS_WAKE_EN1_CLK_PERI_UART1_BITS |
+		CLOCKS_WAKE_EN1_CLK_SYS_UART0_BITS |
+		CLOCKS_WAKE_EN1_CLK_PERI_UART0_BITS;
+#endif
+
+	constexpr const uint32_t usb_pll_hz = 48 * MHZ;
+
+	static uint32_t now_ms()
+	{
+		return static_cast<uint32_t>(time_us_64() / 1000);
+	}
+
+	void power_manager::initialize()
+	{
+		full_speed_khz_ = clock_get_hz(clk_sys) / 1000;
+		clock_stop(clk_adc);
+		clock_stop(clk_rtc);
+		hw_clear_bits(&clocks_hw->wake_en0, unused_clocks0);
+		hw_clear_bits(&clocks_hw->wake_en1, unused_clocks1);
+		hw_clear_bits(&clocks_hw->sleep_en0, unused_clocks0);
+		hw_clear_bits(&clocks_hw->sleep_en1, unused_clocks1);
+	}
+
+	void power_manager::enter_low_power()
+	{
+		if (low_power_)
+			return;
+
+		// The USB PLL has to keep running for the bus anyway, so run
+		// everything else off it too, and stop the system PLL. The PIO
+		// dividers stay as they are, which only makes the bus slower.
+		clock_configure(clk_sys,
+			CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+			CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+			usb_pll_hz, usb_pll_hz);
+		clock_configure(clk_peri, 0,
+			CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS,
+			usb_pll_hz, usb_pll_hz);
+		pll_deinit(pll_sys);
+		retune_ticks();
+#ifdef SCTU_LOG_UART
+		uart_set_baudrate(uart_default, 115200);
+#endif
+
+		entered_ms_ = now_ms();
+		suspends_ = suspends_ + 1;
+		low_power_ = true;
+	}
+
+	void power_manager::exit_low_power()
+	{
+		if (!low_power_)
+			return;
+
+		// Brings the system PLL back, and moves clk_sys and clk_peri to it
+		set_sys_clock_khz(full_speed_khz_, true);
+		retune_ticks();
+#ifdef SCTU_LOG_UART
+		uart_set_baudrate(uart_default, 115200);
+#endif
+
+		low_power_ms_ = low_power_ms_ + (now_ms() - entered_ms_);
+		low_power_ = false;
+	}
+
+	power_manager::stats power_manager::get_stats() const
+	{
+		uint32_t low_power_ms = low_power_ms_;
+		if (low_power_)
+			low_power_ms += now_ms() - entered_ms_;
+		return stats {
+			.suspends = suspends_,
+			.low_power_ms = low_power_ms,
+		};
+	}
+
+	void power_manager::retune_ticks()
+	{
+		// SysTick counts clk_sys, and only the core it's on can reach it, so
+		// visit every core. Changing the affinity of the running task
+		// switches cores before returning.
+		const UBaseType_t affinity = vTaskCoreAffinityGet(nullptr);
+		const uint32_t reload = clock_get_hz(clk_sys) / configTICK_RATE_HZ - 1;
+		for (UBaseType_t core = 0; core < configNUMBER_OF_CORES; ++core)
+		{
+			vTaskCoreAffinitySet(nullptr, 1 << core);
+			if (systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS)
+			{
+				systick_hw->rvr = reload;
+				systick_hw->cvr = 0;
+			}
+		}
+		vTaskCoreAffinitySet(nullptr, affinity);
+	}
+
+	power_manager power;
+}
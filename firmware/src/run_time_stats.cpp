@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/run_time_stats.h>
+
+#include <pico/platform.h>
+#include <pico/time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace sctu
+{
+	// Thread local storage slot holding the core a task last ran on, plus
+	// one so a task that never ran reads as null. The last slot is ours.
+	constexpr const BaseType_t core_storage_index =
+		configNUM_THREAD_LOCAL_STORAGE_POINTERS - 1;
+
+	namespace
+	{
+		/** Scheduler state of a core, only written by its own switch hook. */
+		struct core_state
+		{
+			/// Odd while the hook is updating the counters.
+			std::atomic<uint32_t> sequence = 0;
+			/// Counters up to switched_us.
+			std::atomic<uint32_t> idle_us = 0;
+			std::atomic<uint32_t> context_switches = 0;
+			/// When the current task was switched in.
+			std::atomic<uint32_t> switched_us = 0;
+			/// Whether the current task is an idle task.
+			std::atomic_bool idle = false;
+			TaskHandle_t current = nullptr;
+		};
+	}
+
+	static std::array<core_state, run_time_cores> cores;
+
+	static bool is_idle_task(TaskHandle_t task)
+	{
+		// With core affinity, idle tasks aren't pinned, any of them may run
+		// on either core
+		for (size_t core = 0; core < run_time_cores; ++core)
+		{
+			if (task == xTaskGetIdleTaskHandleForCore(core))
+				return true;
+		}
+		return false;
+	}
+
+	core_stats get_core_stats(size_t core)
+	{
+		constexpr auto relaxed = std::memory_order_relaxed;
+		const core_state& state = cores[core];
+		core_stats result;
+		uint32_t sequence;
+		do
+		{
+			sequence = state.sequence.load(std::memory_order_acquire);
+			result.idle_us = state.idle_us.load(relaxed);
+			result.context_switches = state.context_switches.load(relaxed);
+			// An idle task may have been running for a while, count it up to
+			// now
+			if (state.idle.load(relaxed))
+				result.idle_us += time_us_32() - state.switched_us.load(relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((sequence & 1) || sequence != state.sequence.load(relaxed));
+		return result;
+	}
+
+	int task_core(TaskHandle_t task)
+	{
+		const uintptr_t core = reinterpret_cast<uintptr_t>(
+			pvTaskGetThreadLocalStoragePointer(task, core_storage_index));
+		return static_cast<int>(core) - 1;
+	}
+}
+
+extern "C" void sctu_task_switched_in(void)
+{
+	using namespace sctu;
+	constexpr auto relaxed = std::memory_order_relaxed;
+
+	// The kernel also calls this when it picks the same task again
+	const uint core = get_core_num();
+	core_state& state = cores[core];
+	const TaskHandle_t task = xTaskGetCurrentTaskHandleForCore(core);
+	if (task == state.current)
+		return;
+
+	const uint32_t now = time_us_32();
+	state.sequence.store(state.sequence.load(relaxed) + 1, relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	if (state.idle.load(relaxed))
+	{
+		state.idle_us.store(state.idle_us.load(relaxed) +
+			(now - state.switched_us.load(relaxed)), relaxed);
+	}
+	state.context_switches.store(
+		state.context_switches.load(relaxed) + 1, relaxed);
+	state.switched_us.store(now, relaxed);
+	state.idle.store(is_idle_task(task), relaxed);
+	state.sequence.store(
+		state.sequence.load(relaxed) + 1, std::memory_order_release);
+	state.current = task;
+
+	vTaskSetThreadLocalStoragePointer(task, core_storage_index,
+		reinterpret_cast<void*>(static_cast<uintptr_t>(core + 1)));
+}
@@ -0,0 +1,10 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/settings.h>
+
+namespace sctu
+{
+	settings system_settings;
+}
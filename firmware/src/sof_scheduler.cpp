@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/sof_scheduler.h>
+#include <sctu/latency.h>
+#include <sctu/settings.h>
+
+#include <tusb.h>
+
+#include <pico/time.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace sctu
+{
+	void sof_scheduler::attach(pio_controllers *controllers)
+	{
+		controllers_ = controllers;
+	}
+
+	void sof_scheduler::update()
+	{
+		const bool enable = system_settings.sof_sync && controllers_;
+		if (enable != enabled_)
+		{
+			tud_sof_cb_enable(enable);
+			enabled_ = enable;
+			frames_ = 0;
+		}
+	}
+
+	void sof_scheduler::frame(uint32_t)
+	{
+		// The SOF callback is deferred to the USB task, so this timestamp
+		// lags the actual frame start by the task's wakeup latency. That lag
+		// is mostly constant, and it's folded into the lead anyway.
+		const uint64_t now = time_us_64();
+		if (!enabled_ || ++frames_ < system_settings.report_interval_ms)
+			return;
+		frames_ = 0;
+
+		const uint32_t period_us = system_settings.report_interval_ms * 1000u;
+		const uint32_t lead_us = std::min<uint32_t>(
+			system_settings.sof_lead_us, period_us);
+		add_alarm_at(
+			from_us_since_boot(now + period_us - lead_us),
+			alarm_callback,
+			this,
+			true);
+	}
+
+	int64_t sof_scheduler::alarm_callback(alarm_id_t, void *data)
+	{
+		auto *self = reinterpret_cast<sof_scheduler*>(data);
+		pio_controllers *controllers = self->controllers_;
+		if (controllers)
+			controllers->start();
+		return 0;
+	}
+
+	void sof_scheduler::report_queued(uint8_t instance)
+	{
+		if (instance < queued_.size())
+			queued_[instance] = time_us_32() | 1; // never 0, that's "none"
+	}
+
+	void sof_scheduler::report_complete(uint8_t instance)
+	{
+		if (instance >= queued_.size())
+			return;
+		const uint32_t queued = queued_[instance].exchange(0);
+		if (!queued)
+			return;
+
+		const int32_t error = static_cast<int32_t>(time_us_32() - queued);
+		min_ = std::min<int32_t>(min_, error);
+		max_ = std::max<int32_t>(max_, error);
+
+		// Keep a running average, halving the history before the sum can
+		// overflow
+		if (reports_ >= (1u << 16))
+		{
+			sum_ = sum_ / 2;
+			reports_ = reports_ / 2;
+		}
+		sum_ = sum_ + error;
+		reports_ = reports_ + 1;
+	}
+
+	sof_scheduler::phase_stats sof_scheduler::stats() const
+	{
+		const uint32_t reports = reports_;
+		return phase_stats {
+			.min_us = reports ? min_.load() : 0,
+			.max_us = reports ? max_.load() : 0,
+			.average_us = reports ? sum_ / static_cast<int32_t>(reports) : 0,
+			.reports = reports,
+		};
+	}
+
+	void sof_scheduler::reset_stats()
+	{
+		min_ = INT32_MAX;
+		max_ = INT32_MIN;
+		sum_ = 0;
+		reports_ = 0;
+	}
+
+	sof_scheduler sof;
+}
+
+// Invoked when the host sends a start of frame, if enabled
+void tud_sof_cb(uint32_t frame_count)
+{
+	sctu::sof.frame(frame_count);
+}
+
+// Invoked when a report was sent to the host
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
+{
+	(void) report;
+	(void) len;
+	sctu::sof.report_complete(instance);
+	sctu::latency.report_complete(instance);
+}
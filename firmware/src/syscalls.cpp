@@ -3,6 +3,7 @@
 /// @file
 
 #include <sctu/cdc_device.h>
+#include <sctu/allocation.h>
 
 #include <tusb.h>
 
@@ -18,6 +19,10 @@
 extern int errno;
 
 #include <pico/rand.h>
+#include <pico/platform.h>
+
+#include <cstdlib>
+#include <new>
 
 // Just hang if we call a pure virtual function, the default implementation
 // relies on too much stuff
@@ -41,6 +46,41 @@ namespace __gnu_cxx
 	}
 }
 
+static std::atomic_bool sealed = false;
+
+void sctu::seal_allocations()
+{
+	sealed = true;
+}
+
+bool sctu::allocations_sealed()
+{
+	return sealed;
+}
+
+#ifdef SCTU_STATIC_ALLOCATION
+// Every C++ allocation ends up here, the array and nothrow forms included
+void* operator new(std::size_t size)
+{
+	if (sealed)
+		panic("allocated %u bytes after initialization", size);
+	void *result = malloc(size);
+	if (!result)
+		panic("out of memory allocating %u bytes", size);
+	return result;
+}
+
+void operator delete(void *pointer) noexcept
+{
+	free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+	free(pointer);
+}
+#endif
+
 // Apparently, if I don't declare this function as used, LTO gets rid of it...
 extern "C" int _write(int fd, char *buf, int count) __attribute__ ((used));
 extern "C" int _write(int fd, char *buf, int count)
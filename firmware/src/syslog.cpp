@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/syslog.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+
+namespace sctu
+{
+	const char* to_string(log_level level)
+	{
+		constexpr const std::array<const char*, 4> names {
+			"debug", "info", "warning", "error" };
+		const size_t index = static_cast<size_t>(level);
+		return index < names.size() ? names[index] : "unknown";
+	}
+
+	size_t format_record(
+		std::span<char> buffer,
+		const char *format,
+		std::span<const uintptr_t> arguments)
+	{
+		size_t used = 0;
+		size_t next = 0;
+		// Always leave room for the terminator snprintf writes
+		while (*format && used + 1 < buffer.size())
+		{
+			if (*format != '%')
+			{
+				buffer[used++] = *format++;
+				continue;
+			}
+
+			// Copy the conversion without its length modifier, every argument
+			// is passed as a plain int, unsigned, or pointer
+			const char *start = format;
+			std::array<char, 16> spec;
+			size_t spec_size = 0;
+			spec[spec_size++] = *format++;
+			while (*format && strchr("-+ #0123456789.", *format) &&
+				spec_size < spec.size() - 2)
+			{
+				spec[spec_size++] = *format++;
+			}
+			while (*format && strchr("hlzjt", *format))
+				++format;
+			const char conversion = *format;
+			if (!conversion)
+				break;
+			++format;
+
+			if (conversion == '%')
+			{
+				buffer[used++] = '%';
+				continue;
+			}
+
+			const size_t available = buffer.size() - used;
+			if (!strchr("diouxXcsp", conversion) || next >= arguments.size())
+			{
+				const size_t length = std::min<size_t>(
+					format - start, available - 1);
+				std::memcpy(buffer.data() + used, start, length);
+				used += length;
+				continue;
+			}
+			spec[spec_size++] = conversion;
+			spec[spec_size] = '\0';
+
+			const uintptr_t value = arguments[next++];
+			char *out = buffer.data() + used;
+			int length;
+			switch (conversion)
+			{
+				case 'd':
+				case 'i':
+				case 'c':
+					length = snprintf(out, available, spec.data(),
+						static_cast<int>(value));
+					break;
+				case 's':
+					length = snprintf(out, available, spec.data(), value ?
+						reinterpret_cast<const char*>(value) : "(null)");
+					break;
+				case 'p':
+					length = snprintf(out, available, spec.data(),
+						reinterpret_cast<const void*>(value));
+					break;
+				default:
+					length = snprintf(out, available, spec.data(),
+						static_cast<unsigned>(value));
+					break;
+			}
+			used += std::min<size_t>(std::max(length, 0), available - 1);
+		}
+		return used;
+	}
+}
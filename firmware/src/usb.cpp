@@ -0,0 +1,356 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR LGPL-2.1-or-later
+// SPDX-FileCopyrightText: Gabriel Marcano, 2024
+/// @file
+
+#include <sctu/usb.h>
+#include <sctu/settings.h>
+#include <sctu/controller.h>
+#include <sctu/static_task.h>
+#include <sctu/task_priorities.h>
+#include <sctu/boot_time.h>
+
+#include <tusb.h>
+// Private, only for usbd_defer_func(), see usb_wake()
+#include <device/usbd_pvt.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+static_assert(sctu::max_players <= 8, "Controller masks are 8 bits");
+static_assert(sctu::max_players <= CFG_TUD_HID,
+	"Every player needs its own HID interface");
+
+// Re-enumerate only after this long without any new change, so a bouncing
+// connector results in a single reconnect...
+constexpr const TickType_t settle_window = pdMS_TO_TICKS(250);
+// ...unless it keeps bouncing for this long, then just go with what we have.
+constexpr const TickType_t max_settle = pdMS_TO_TICKS(1000);
+
+// Make these atomic so we can read them from any thread/task. The requested
+// values are what the firmware wants, the enumerated ones are what the host
+// was last told about in the configuration descriptor.
+static std::atomic<uint8_t> active_controllers = 0;
+static std::atomic<uint8_t> requested_interval = 10;
+static std::atomic<sctu::hid_layout> requested_layout = sctu::hid_layout::dynamic;
+
+static std::atomic<uint8_t> enumerated_controllers = 0;
+static std::atomic<uint8_t> enumerated_interval = 10;
+static std::atomic<sctu::hid_layout> enumerated_layout = sctu::hid_layout::dynamic;
+
+static std::atomic<uint32_t> requests = 0;
+static std::atomic<uint32_t> reenumerations = 0;
+
+static TaskHandle_t reenumeration_handle = nullptr;
+static sctu::static_task<configMINIMAL_STACK_SIZE> reenumeration;
+
+// TinyUSB must only be used from the USB task, so the re-enumeration task
+// asks it to drop or restore the connection through this.
+enum class link_request : uint8_t
+{
+	none,
+	disconnect,
+	connect,
+};
+
+static std::atomic<link_request> pending_link = link_request::none;
+
+// TinyUSB's event queue only exists after tusb_init()
+static std::atomic_bool initialized = false;
+
+// Set once the controller task has sampled the controllers at boot. Without
+// it, USB still starts after probe_timeout, and enumerates the controllers
+// as they show up.
+static std::atomic_bool probed = false;
+static std::atomic<TaskHandle_t> usb_task = nullptr;
+constexpr const TickType_t probe_timeout = pdMS_TO_TICKS(50);
+
+// Mirrors tud_suspended() for other tasks, with the task to tell about
+// changes
+static std::atomic_bool suspended = false;
+static std::atomic<TaskHandle_t> power_listener = nullptr;
+
+// Blocks until the USB task has carried out the request
+static void request_link(link_request request)
+{
+	pending_link = request;
+	usb_wake();
+	while (pending_link != link_request::none)
+		vTaskDelay(1);
+}
+
+static void request_reenumeration()
+{
+	requests = requests + 1;
+	if (reenumeration_handle)
+		xTaskNotifyGive(reenumeration_handle);
+}
+
+// The controllers that need an interface in the requested configuration
+static uint8_t requested_controllers()
+{
+	return requested_layout == sctu::hid_layout::dynamic ?
+		active_controllers.load() : enumerated_controllers.load();
+}
+
+static void reenumeration_task(void*)
+{
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		// Keep waiting while changes keep coming in
+		const TickType_t start = xTaskGetTickCount();
+		while (ulTaskNotifyTake(pdTRUE, settle_window) &&
+			(xTaskGetTickCount() - start) < max_settle);
+
+		const uint8_t controllers = requested_controllers();
+		const uint8_t interval = requested_interval;
+		const sctu::hid_layout layout = requested_layout;
+		if (controllers == enumerated_controllers &&
+			interval == enumerated_interval &&
+			layout == enumerated_layout)
+		{
+			// Whatever changed was undone before settling
+			continue;
+		}
+
+		request_link(link_request::disconnect);
+		enumerated_controllers = controllers;
+		enumerated_interval = interval;
+		enumerated_layout = layout;
+		// FIXME is there a better way to know when we're disconnected?
+		vTaskDelay(100);
+		request_link(link_request::connect);
+		reenumerations = reenumerations + 1;
+	}
+}
+
+void usb_initialize_reenumeration_task()
+{
+	// Anything USB related needs to be on the same core-- just use core 2
+	reenumeration_handle = reenumeration.create(
+		reenumeration_task,
+		"sctu_usb_reenum",
+		nullptr,
+		sctu::background_task_priority,
+		1 << 1);
+}
+
+void usb_initialize()
+{
+	usb_prepare_descriptors();
+
+	// The controller task checks for the handle after setting probed, so
+	// one of the two sides always sees the other
+	usb_task = xTaskGetCurrentTaskHandle();
+	if (!probed)
+		ulTaskNotifyTake(pdTRUE, probe_timeout);
+
+	// Enumerate with the stored configuration and the controllers already
+	// connected, instead of re-enumerating as soon as the controller task
+	// asks for them
+	requested_interval = enumerated_interval =
+		sctu::system_settings.report_interval_ms.load();
+	requested_layout = enumerated_layout = sctu::system_settings.layout.load();
+	enumerated_controllers = requested_controllers();
+	tusb_init();
+	initialized = true;
+	sctu::boot_times.mark(sctu::boot_stage::usb_started);
+}
+
+void usb_set_probed_controllers(uint8_t controllers)
+{
+	active_controllers = controllers;
+	probed = true;
+	if (TaskHandle_t task = usb_task)
+		xTaskNotifyGive(task);
+}
+
+void tud_mount_cb()
+{
+	sctu::boot_times.mark(sctu::boot_stage::mounted);
+}
+
+static void set_suspended(bool state)
+{
+	suspended = state;
+	if (TaskHandle_t task = power_listener)
+		xTaskNotifyGive(task);
+}
+
+void tud_suspend_cb(bool)
+{
+	set_suspended(true);
+}
+
+void tud_resume_cb()
+{
+	set_suspended(false);
+}
+
+void tud_umount_cb()
+{
+	// A bus reset ends a suspend without a resume
+	set_suspended(false);
+}
+
+bool usb_suspended()
+{
+	return suspended;
+}
+
+void usb_set_power_listener(TaskHandle_t task)
+{
+	power_listener = task;
+}
+
+// Deferred to the USB task by usb_wake(), only there to make tud_task() return
+static void wake_callback(void*)
+{
+}
+
+void usb_wake()
+{
+	// The USB task blocks in tud_task() on TinyUSB's own event queue, and
+	// the public API has no way to post to it: tud_task_ext() can only time
+	// out, which would mean waking up on a period instead of on demand. So
+	// this uses TinyUSB's internal deferral, and it's the only place that
+	// does. If it ever changes, this fails to build instead of misbehaving.
+	if (initialized)
+		usbd_defer_func(wake_callback, nullptr, false);
+}
+
+void usb_service()
+{
+	switch (pending_link.load())
+	{
+		case link_request::disconnect:
+			tud_disconnect();
+			break;
+		case link_request::connect:
+			tud_connect();
+			break;
+		case link_request::none:
+			return;
+	}
+	pending_link = link_request::none;
+}
+
+uint8_t usb_get_active_controllers()
+{
+	return active_controllers;
+}
+
+uint8_t usb_get_enumerated_controllers()
+{
+	return enumerated_controllers;
+}
+
+usb_reenumeration_stats usb_get_reenumeration_stats()
+{
+	const uint32_t requested = requests;
+	const uint32_t done = reenumerations;
+	return usb_reenumeration_stats {
+		.requests = requested,
+		.reenumerations = done,
+		.suppressed = requested > done ? requested - done : 0,
+	};
+}
+
+int usb_hid_instance(uint8_t controller)
+{
+	if (controller >= CFG_TUD_HID)
+		return -1;
+	if (enumerated_layout == sctu::hid_layout::fixed)
+		return controller;
+	if (enumerated_layout == sctu::hid_layout::combined)
+		return 0;
+
+	// Interfaces are only assigned to enumerated controllers, in order
+	const uint8_t enumerated = enumerated_controllers;
+	if (!((enumerated >> controller) & 1))
+		return -1;
+	return std::popcount(
+		static_cast<uint8_t>(enumerated & ((1u << controller) - 1)));
+}
+
+int usb_hid_controller(uint8_t instance)
+{
+	if (instance >= CFG_TUD_HID)
+		return -1;
+	if (enumerated_layout == sctu::hid_layout::fixed)
+		return instance;
+	// The only interface is shared by every controller
+	if (enumerated_layout == sctu::hid_layout::combined)
+		return -1;
+
+	// Find the enumerated controller with this many enumerated controllers
+	// before it
+	uint8_t enumerated = enumerated_controllers;
+	for (uint8_t controller = 0; enumerated; ++controller, enumerated >>= 1)
+	{
+		if ((enumerated & 1) && instance-- == 0)
+			return controller;
+	}
+	return -1;
+}
+
+uint8_t usb_hid_report_id(uint8_t controller)
+{
+	return enumerated_layout == sctu::hid_layout::combined ? controller + 1 : 0;
+}
+
+void usb_enable_controller(uint8_t controller)
+{
+	uint8_t active = active_controllers;
+	if (controller & active)
+		return;
+	active |= controller;
+	active_controllers = active;
+
+	// Other layouts always have every interface, nothing to re-enumerate
+	if (requested_layout == sctu::hid_layout::dynamic)
+		request_reenumeration();
+}
+
+void usb_disable_controller(uint8_t controller)
+{
+	uint8_t active = active_controllers;
+	if ((controller & active) == 0)
+		return;
+	active &= ~controller;
+	active_controllers = active;
+
+	if (requested_layout == sctu::hid_layout::dynamic)
+		request_reenumeration();
+}
+
+uint8_t usb_get_report_interval()
+{
+	return enumerated_interval;
+}
+
+void usb_set_report_interval(uint8_t ms)
+{
+	if (requested_interval == ms)
+		return;
+	requested_interval = ms;
+	request_reenumeration();
+}
+
+sctu::hid_layout usb_get_layout()
+{
+	return enumerated_layout;
+}
+
+void usb_set_layout(sctu::hid_layout layout)
+{
+	if (requested_layout == layout)
+		return;
+	requested_layout = layout;
+	request_reenumeration();
+}
@@ -24,21 +24,21 @@
  *
  */
 
+#include <sctu/usb.h>
+#include <sctu/boot_time.h>
+
 #include <tusb.h>
 
 #include <pico/unique_id.h>
 
-#include <FreeRTOS.h>
-#include <task.h>
-
 #include <array>
 #include <cstdint>
 #include <string_view>
 #include <concepts>
-#include <vector>
+#include <algorithm>
+#include <iterator>
 #include <atomic>
 #include <span>
-#include <memory>
 #include <bit>
 
 // Gamepad Report Descriptor Template
@@ -108,6 +108,7 @@ const tusb_desc_device_t desc_device =
 // Application return pointer to descriptor
 const uint8_t* tud_descriptor_device_cb(void)
 {
+	sctu::boot_times.mark(sctu::boot_stage::host_request);
 	return (uint8_t const *) &desc_device;
 }
 
@@ -120,14 +121,33 @@ const auto desc_hid_report = std::to_array<uint8_t>
 	SNES_HID_REPORT_DESC_GAMEPAD()
 });
 
+// Report descriptor for the combined layout, with one gamepad collection per
+// controller. The report ID of each controller is its index + 1.
+const auto desc_hid_report_combined = std::to_array<uint8_t>
+({
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(1)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(2)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(3)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(4)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(5)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(6)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(7)),
+	SNES_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(8))
+});
+
+static_assert(CFG_TUD_HID == 8,
+	"Combined report descriptor must have one collection per controller");
+
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 const uint8_t* tud_hid_descriptor_report_cb(uint8_t itf)
 {
-	// All HID descriptors have the same report, so we don't need to select
-	// between them
+	// All per-controller HID interfaces have the same report, so we only
+	// need to select between layouts
 	(void) itf;
+	if (usb_get_layout() == sctu::hid_layout::combined)
+		return desc_hid_report_combined.data();
 	return desc_hid_report.data();
 }
 
@@ -140,11 +160,6 @@ constexpr unsigned config_total_length(unsigned hid)
 	return TUD_CONFIG_DESC_LEN + (hid * TUD_HID_DESC_LEN) + TUD_CDC_DESC_LEN;
 }
 
-// We'll rebuild the descriptor manually, as the number of controllers plugged
-// in varies. The first two interfaces are for CDC, and then there are 0 to 4
-// controllers plugged in.
-static std::vector<uint8_t> desc_configuration;
-
 enum
 {
 	ITF_NUM_CDC,
@@ -157,26 +172,47 @@ const constexpr int EPNUM_CDC_OUT   = 0x02;
 const constexpr int EPNUM_CDC_IN    = 0x82;
 const constexpr int EPNUM_HID_BASE  = 0x03;
 
-void update_configuration(uint8_t controller_bitmask)
-{
-	// Clamp the maximum number of controllers to the maximum the USB library
-	// can manage for HID devices.
-	controller_bitmask &= ((1u << CFG_TUD_HID) - 1);
+static_assert(EPNUM_HID_BASE + CFG_TUD_HID <= 16,
+	"The RP2040 only has 16 endpoints");
 
-	const unsigned number_of_controllers = std::popcount(controller_bitmask);
-	const uint8_t total_interfaces = static_cast<uint8_t>(2 + number_of_controllers);
+// Every configuration descriptor is padded to the size of the largest one, so
+// they can all live in one table.
+using configuration_descriptor =
+	std::array<uint8_t, config_total_length(CFG_TUD_HID)>;
 
-	// Update the configuration descriptor. The first two interfaces are always
-	// the CDC control and data ones. If there are any controllers, they
-	// follow the CDC descriptors.
-	desc_configuration = std::vector<uint8_t> {
+/** Builds the configuration descriptor for the given number of HID interfaces.
+ *
+ * The first two interfaces are always the CDC control and data ones. If there
+ * are any HID interfaces, they follow the CDC descriptors. The descriptor only
+ * depends on how many interfaces there are, as the string descriptor
+ * callback works out which controller each HID interface belongs to.
+ *
+ * @param[in] controllers Number of HID interfaces.
+ * @param[in] interval Endpoint polling interval in ms.
+ * @param[in] report_length Length of the HID report descriptor.
+ * @param[in] string_index String index of the first HID interface, following
+ *  interfaces use consecutive indices.
+ *
+ * @returns The configuration descriptor.
+ */
+constexpr configuration_descriptor make_configuration(
+	uint8_t controllers,
+	uint8_t interval,
+	uint16_t report_length = sizeof(desc_hid_report),
+	uint8_t string_index = 5)
+{
+	const uint8_t total_interfaces = static_cast<uint8_t>(2 + controllers);
+	const uint16_t total_length =
+		static_cast<uint16_t>(config_total_length(controllers));
+
+	const auto header = std::to_array<uint8_t>({
 		TUD_CONFIG_DESCRIPTOR(
-			1,                                          // config number
-			total_interfaces,                           // interface count
-			0,                                          // string index
-			config_total_length(number_of_controllers), // total length
-			0x00,                                       // attribute
-			500                                         // power in mA
+			1,                // config number
+			total_interfaces, // interface count
+			0,                // string index
+			total_length,     // total length
+			0x00,             // attribute
+			500               // power in mA
 		),
 
 		TUD_CDC_DESCRIPTOR(
@@ -188,74 +224,74 @@ void update_configuration(uint8_t controller_bitmask)
 			EPNUM_CDC_IN,    // ep data address in
 			64               // size
 		),
-	};
+	});
 
-	// Correctly attribute the string index to the interface based on the
-	// actual controller bit enabled
-	// To do that, we need to track both the controller index (i), and the
-	// number of the interfaces that need to be configured (count).
-	for (uint8_t i = 0, count = 0; i < 4; ++i)
+	configuration_descriptor result = {};
+	auto out = std::copy(std::begin(header), std::end(header), std::begin(result));
+	for (uint8_t i = 0; i < controllers; ++i)
 	{
-		// Skip if the controller is not enabled
-		if (!((controller_bitmask >> i) & 1))
-			continue;
-
-		const uint8_t itf_num = static_cast<uint8_t>(ITF_NUM_HID_BASE + count);
-		const uint8_t ep_addr = static_cast<uint8_t>(0x80 | (EPNUM_HID_BASE + count));
-		auto hid = std::to_array<uint8_t>({
+		const uint8_t itf_num = static_cast<uint8_t>(ITF_NUM_HID_BASE + i);
+		const uint8_t str_idx = static_cast<uint8_t>(string_index + i);
+		const uint8_t ep_addr = static_cast<uint8_t>(0x80 | (EPNUM_HID_BASE + i));
+		const auto hid = std::to_array<uint8_t>({
 			TUD_HID_DESCRIPTOR(
-				itf_num,                     // interface number
-				static_cast<uint8_t>(5 + i), // string index
-				HID_ITF_PROTOCOL_NONE,       // protocol
-				sizeof(desc_hid_report),     // report descriptor length
-				ep_addr,                     // ep in & out address
-				CFG_TUD_HID_EP_BUFSIZE,      // size
-				10                           // polling interval
+				itf_num,                 // interface number
+				str_idx,                 // string index
+				HID_ITF_PROTOCOL_NONE,   // protocol
+				report_length,           // report descriptor length
+				ep_addr,                 // ep in & out address
+				CFG_TUD_HID_EP_BUFSIZE,  // size
+				interval                 // polling interval
 			),
 		});
-		desc_configuration.insert(
-			std::end(desc_configuration), std::begin(hid), std::end(hid));
-		++count;
+		out = std::copy(std::begin(hid), std::end(hid), out);
 	}
+	return result;
 }
 
-// Make this atomic so we can read it from any thread/task
-static std::atomic<uint8_t> active_controllers = 0;
-
-uint8_t usb_get_active_controllers()
+// All configuration descriptors, indexed by report interval (in the same
+// order as sctu::report_intervals_ms) and number of controllers. Building
+// them at compile time keeps heap allocations out of enumeration, and as
+// they're never modified, a transfer can't read a descriptor as it changes.
+constexpr auto desc_configurations = []
 {
-	return active_controllers;
-}
+	std::array<
+		std::array<configuration_descriptor, CFG_TUD_HID + 1>,
+		sctu::report_intervals_ms.size()> table = {};
+	for (size_t i = 0; i < table.size(); ++i)
+	{
+		for (uint8_t count = 0; count < table[i].size(); ++count)
+		{
+			table[i][count] =
+				make_configuration(count, sctu::report_intervals_ms[i]);
+		}
+	}
+	return table;
+}();
 
-void usb_enable_controller(uint8_t controller)
+// Configuration descriptors for the combined layout, indexed by report
+// interval. There's a single HID interface regardless of what's connected.
+constexpr auto desc_configurations_combined = []
 {
-	uint8_t active = active_controllers;
-	controller &= 0xF; // Just 4 controllers
-	if (controller & active)
-		return;
-	active |= controller;
-	active_controllers = active;
-
-	tud_disconnect();
-	// FIXME is there a better way to know when we're disconnected?
-	vTaskDelay(100);
-	tud_connect();
-}
+	std::array<configuration_descriptor, sctu::report_intervals_ms.size()>
+		table = {};
+	for (size_t i = 0; i < table.size(); ++i)
+	{
+		table[i] = make_configuration(
+			1,
+			sctu::report_intervals_ms[i],
+			sizeof(desc_hid_report_combined),
+			5 + CFG_TUD_HID);
+	}
+	return table;
+}();
 
-void usb_disable_controller(uint8_t controller)
-{
-	uint8_t active = active_controllers;
-	controller &= 0xF; // Just 4 controllers
-	if ((controller & active) == 0)
-		return;
-	active &= ~controller;
-	active_controllers = active;
-
-	tud_disconnect();
-	// FIXME is there a better way to know when we're disconnected?
-	vTaskDelay(100);
-	tud_connect();
-}
+static_assert(
+	desc_configurations.back().back()[2] ==
+		(config_total_length(CFG_TUD_HID) & 0xFF) &&
+	desc_configurations.back().back()[3] ==
+		(config_total_length(CFG_TUD_HID) >> 8),
+	"HID interfaces don't fill the configuration descriptor");
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
@@ -264,8 +300,26 @@ const uint8_t* tud_descriptor_configuration_cb(uint8_t index)
 {
 	// we onnly have a single configuration
 	(void) index; // for multiple configurations
-	update_configuration(active_controllers);
-	return desc_configuration.data();
+
+	// The interval is always one of the supported ones, but fall back to the
+	// slowest if not
+	const auto interval = std::ranges::find(
+		sctu::report_intervals_ms, usb_get_report_interval());
+	const size_t interval_index = interval != std::end(sctu::report_intervals_ms) ?
+		std::distance(std::begin(sctu::report_intervals_ms), interval) :
+		sctu::report_intervals_ms.size() - 1;
+
+	if (usb_get_layout() == sctu::hid_layout::combined)
+		return desc_configurations_combined[interval_index].data();
+
+	// Clamp the maximum number of controllers to the maximum the USB library
+	// can manage for HID devices.
+	const unsigned controllers = usb_get_layout() == sctu::hid_layout::fixed ?
+		CFG_TUD_HID :
+		std::popcount(static_cast<uint8_t>(
+			usb_get_enumerated_controllers() & ((1u << CFG_TUD_HID) - 1)));
+
+	return desc_configurations[interval_index][controllers].data();
 }
 
 //--------------------------------------------------------------------+
@@ -284,6 +338,11 @@ constexpr auto string_desc_arr = std::array
 	u"SNES Controller P2",                 // 6: USB HID, controller 2
 	u"SNES Controller P3",                 // 7: USB HID, controller 3
 	u"SNES Controller P4",                 // 8: USB HID, controller 4
+	u"SNES Controller P5",                 // 9: USB HID, controller 5
+	u"SNES Controller P6",                 // 10: USB HID, controller 6
+	u"SNES Controller P7",                 // 11: USB HID, controller 7
+	u"SNES Controller P8",                 // 12: USB HID, controller 8
+	u"SNES Controllers",                   // 13: USB HID, combined layout
 };
 
 template<typename T>
@@ -317,52 +376,32 @@ static constexpr auto to_little_endian(std::integral auto value)
 	}
 }
 
-/** Helper to get Pico ID and ready it for USB strings use.
- *
- * Making it a singleton that gets evaluated lazily as the Pico ID is
- * initialized during general construction and can run afoul of the static
- * initialization fiasco issue.
- */
-class pico_id
-{
-public:
-	static const std::array<uint16_t, PICO_UNIQUE_BOARD_ID_SIZE_BYTES*2>& get()
-	{
-		if (!id_)
-		{
-			id_.reset(new pico_id());
-		}
-		return id_->data;
-	}
+// Board ID as a hex string, ready for the serial number descriptor. Built
+// by usb_prepare_descriptors() before USB starts, instead of on the first
+// request.
+static std::array<uint16_t, PICO_UNIQUE_BOARD_ID_SIZE_BYTES*2> serial_string;
 
-private:
-	static std::unique_ptr<pico_id> id_;
+void usb_prepare_descriptors()
+{
+	pico_unique_board_id_t id;
+	pico_get_unique_board_id(&id);
 
-	pico_id()
+	// Convert ID to a hex string, don't bother using stringstream as that
+	// pulls in way, way too much code.
+	for (size_t i = 0; i < sizeof(id.id); ++i)
 	{
-		pico_unique_board_id_t id;
-		pico_get_unique_board_id(&id);
-
-		// Convert ID to a hex string, don't bother using stringstream as that
-		// pulls in way, way too much code.
-		for (size_t i = 0; i < sizeof(id.id); ++i)
+		unsigned char byte = id.id[i];
+		for (size_t j = 0; j < 2; ++j)
 		{
-			unsigned char byte = id.id[i];
-			for (size_t j = 0; j < 2; ++j)
-			{
-				unsigned char nibble = (byte >> (4*j)) & 0xF;
-				if (nibble < 10)
-					nibble = '0' + nibble;
-				else
-					nibble = 'A' + (nibble - 10);
-				data[2*i + j] = to_little_endian(static_cast<uint16_t>(nibble));
-			}
+			unsigned char nibble = (byte >> (4*j)) & 0xF;
+			if (nibble < 10)
+				nibble = '0' + nibble;
+			else
+				nibble = 'A' + (nibble - 10);
+			serial_string[2*i + j] = to_little_endian(static_cast<uint16_t>(nibble));
 		}
 	}
-
-	std::array<uint16_t, PICO_UNIQUE_BOARD_ID_SIZE_BYTES*2> data;
-};
-std::unique_ptr<pico_id> pico_id::id_{nullptr};
+}
 
 // Maximum USB string buffer size in 16 bit units
 constexpr size_t desc_max =
@@ -387,18 +426,28 @@ const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
 	uint8_t chr_count = 0;
 	if (index == 3)
 	{
-		static_assert(sizeof(pico_id::get()) < (sizeof(_desc_str) - 1));
-		memcpy(_desc_str.data() + 1, pico_id::get().data(), pico_id::get().size() * 2);
-		chr_count = pico_id::get().size();
+		static_assert(sizeof(serial_string) < (sizeof(_desc_str) - 1));
+		memcpy(_desc_str.data() + 1, serial_string.data(), serial_string.size() * 2);
+		chr_count = serial_string.size();
 	}
 	else
 	{
 		// Note: the 0xEE index string is a Microsoft OS 1.0 Descriptors.
 		// https://docs.microsoft.com/en-us/windows-hardware/drivers/usbcon/microsoft-defined-usb-descriptors
 
-		if (index > string_desc_arr.size())
+		if (index >= string_desc_arr.size())
 			return nullptr;
 
+		// HID interface strings are assigned in interface order, map them
+		// back to the controller that owns the interface
+		if (index >= 5 && index < 5 + CFG_TUD_HID)
+		{
+			const int controller = usb_hid_controller(index - 5);
+			if (controller < 0)
+				return nullptr;
+			index = static_cast<uint8_t>(5 + controller);
+		}
+
 		const std::u16string_view str = string_desc_arr[index];
 
 		chr_count = str.length();
@@ -414,30 +463,3 @@ const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
 
 	return _desc_str.data();
 }
-
-// Invoked when received GET_REPORT control request
-// Application must fill buffer report's content and return its length.
-// Return zero will cause the stack to STALL request
-uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
-{
-	// TODO not Implemented
-	(void) itf;
-	(void) report_id;
-	(void) report_type;
-	(void) buffer;
-	(void) reqlen;
-
-	return 0;
-}
-
-// Invoked when received SET_REPORT control request or
-// received data on OUT endpoint ( Report ID = 0, Type = 0 )
-void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
-{
-	// This example doesn't use multiple report and report ID
-	(void) itf;
-	(void) report_id;
-	(void) report_type;
-	(void)buffer;
-	(void)bufsize;
-}
@@ -3,83 +3,217 @@
 /// @file
 
 #include <sctu/watchdog.h>
+#include <sctu/log.h>
+#include <sctu/static_task.h>
+#include <sctu/task_priorities.h>
 
 #include <hardware/watchdog.h>
+#include <hardware/structs/watchdog.h>
+#include <pico/time.h>
 
 #include <FreeRTOS.h>
 #include <queue.h>
 #include <task.h>
 
 #include <atomic>
-#include <algorithm>
 #include <array>
-#include <ranges>
+#include <cstdint>
 
 namespace sctu
 {
 	constexpr const int cpu_cores = 2;
-	static std::array<std::atomic_bool, cpu_cores> watchdog_cpu_status;
 	static std::array<const char*, cpu_cores> watchdog_task_names {
 		"sctu_watchdog_cpu0",
 		"sctu_watchdog_cpu1"
 	};
+	static std::array<static_task<configMINIMAL_STACK_SIZE>, cpu_cores>
+		watchdog_cpu_tasks;
+	static static_task<configMINIMAL_STACK_SIZE> watchdog_core_task;
 
-	void watchdog_cpu_task(void* status)
+	// The per-core tasks beat every 50 ms, anything past twice that means
+	// the core stopped scheduling them
+	constexpr const uint32_t cpu_deadline_us = 100000;
+
+	constexpr const TickType_t check_period = pdMS_TO_TICKS(10);
+	// If the supervisor itself didn't run for this long, the whole board was
+	// held up (e.g. both cores out of XIP for a flash erase), and nobody
+	// could have beaten their heartbeat
+	constexpr const uint32_t stall_us = 3 * check_period * portTICK_PERIOD_MS * 1000;
+
+	// Scratch registers 0-3 survive a watchdog reset and aren't used by the
+	// SDK, the low byte is the heartbeat that got the board reset
+	constexpr const uint32_t reset_magic = 0x53435400;
+
+	static void watchdog_cpu_task(void *id)
 	{
 		for(;;)
 		{
-			std::atomic_bool &status_ =
-				*reinterpret_cast<std::atomic_bool*>(status);
-			status_ = true;
+			supervisor.beat(reinterpret_cast<intptr_t>(id));
 			vTaskDelay(50);
 		}
 	}
 
-	static void watchdog_task(void*)
+	int watchdog_supervisor::add(const char *name, uint32_t deadline_us,
+		inplace_function<void()> recover)
+	{
+		const size_t slot = reserved_.fetch_add(1);
+		if (slot >= heartbeats_.size())
+			return -1;
+		heartbeat& entry = heartbeats_[slot];
+		entry.name = name;
+		entry.recover = recover;
+		entry.deadline_us = deadline_us;
+
+		// The supervisor walks slots in order, so publish them in order
+		while (ready_.load(std::memory_order_acquire) != slot)
+			taskYIELD();
+		ready_.store(slot + 1, std::memory_order_release);
+		return slot;
+	}
+
+	void watchdog_supervisor::beat(int id)
+	{
+		heartbeat& entry = heartbeats_[id];
+		const uint32_t now_us = time_us_32();
+		const uint32_t beats = entry.beats.load(std::memory_order_relaxed);
+		if (beats)
+		{
+			const uint32_t interval_us = now_us - entry.last_us;
+			if (interval_us > entry.worst_us.load(std::memory_order_relaxed))
+				entry.worst_us.store(interval_us, std::memory_order_relaxed);
+			if (interval_us > entry.deadline_us.load(std::memory_order_relaxed))
+				entry.misses.fetch_add(1, std::memory_order_relaxed);
+		}
+		entry.last_us.store(now_us, std::memory_order_relaxed);
+		entry.beats.store(beats + 1, std::memory_order_release);
+	}
+
+	void watchdog_supervisor::set_deadline(int id, uint32_t deadline_us)
+	{
+		heartbeats_[id].deadline_us.store(deadline_us, std::memory_order_relaxed);
+	}
+
+	watchdog_supervisor::heartbeat_stats watchdog_supervisor::get_stats(
+		size_t id) const
+	{
+		const heartbeat& entry = heartbeats_[id];
+		heartbeat_stats result {
+			.name = entry.name,
+			.deadline_us = entry.deadline_us,
+			.beats = entry.beats.load(std::memory_order_acquire),
+			.misses = entry.misses,
+			.worst_us = entry.worst_us,
+			.recoveries = entry.recoveries,
+		};
+
+		// A task that's stuck right now never gets to record it
+		const uint32_t silent_us = time_us_32() - entry.last_us;
+		if (result.beats && silent_us > result.deadline_us)
+			++result.misses;
+		if (result.beats && silent_us > result.worst_us)
+			result.worst_us = silent_us;
+		return result;
+	}
+
+	bool watchdog_supervisor::check(uint32_t now_us, uint32_t resumed_us)
+	{
+		const size_t count = ready_.load(std::memory_order_acquire);
+		for (size_t id = 0; id < count; ++id)
+		{
+			heartbeat& entry = heartbeats_[id];
+			const uint32_t beats = entry.beats.load(std::memory_order_acquire);
+			if (!beats)
+				continue;
+
+			// Silence during a stall of the whole board isn't the task's
+			// fault, only count it from when the board came back
+			uint32_t since_us = entry.last_us.load(std::memory_order_relaxed);
+			if (static_cast<int32_t>(resumed_us - since_us) > 0)
+				since_us = resumed_us;
+			const uint32_t silent_us = now_us - since_us;
+			const uint32_t deadline_us = entry.deadline_us;
+			if (silent_us <= 2 * deadline_us)
+				continue;
+
+			// One recovery per silence, then give it two deadlines to work
+			if (entry.recover && entry.recovered_beat != beats)
+			{
+				entry.recovered_beat = beats;
+				entry.recoveries.fetch_add(1, std::memory_order_relaxed);
+				sys_log.log(log_level::warning,
+					"watchdog: %s silent for %lu us, recovering",
+					entry.name, silent_us);
+				entry.recover();
+				continue;
+			}
+			if (entry.recover && silent_us <= 4 * deadline_us)
+				continue;
+
+			sys_log.log(log_level::error,
+				"watchdog: %s silent for %lu us, resetting",
+				entry.name, silent_us);
+			watchdog_hw->scratch[0] = reset_magic | id;
+			return false;
+		}
+		return true;
+	}
+
+	void watchdog_supervisor::supervisor_task(void *self_)
 	{
+		auto& self = *reinterpret_cast<watchdog_supervisor*>(self_);
 		// The watchdog period needs to be long enough so long lock periods
 		// (apparently something in the wifi subsystem holds onto a lock for a
 		// while) are tolerated.
 		watchdog_enable(200, true);
+		uint32_t last_check_us = time_us_32();
+		uint32_t resumed_us = last_check_us;
+		bool healthy = true;
 		for(;;)
 		{
-			// The compiler is apparently smart enough to optimize this by
-			// unrolling the range check
-			constexpr const auto value = [](bool val){return val;};
-			if (std::ranges::all_of(watchdog_cpu_status, value))
-			{
+			const uint32_t now_us = time_us_32();
+			if (now_us - last_check_us > stall_us)
+				resumed_us = now_us;
+			last_check_us = now_us;
+
+			// Once a reset is decided, stop petting for good and let the
+			// hardware watchdog take the board down
+			healthy = healthy && self.check(now_us, resumed_us);
+			if (healthy)
 				watchdog_update();
-				std::ranges::fill(watchdog_cpu_status, 0);
-			}
-			vTaskDelay(30);
+			vTaskDelay(check_period);
 		}
 	}
 
-	void initialize_watchdog_tasks()
+	void watchdog_supervisor::initialize_tasks()
 	{
-		// Watchdog priority is higher
-		// Dedicated watchdog tasks on each core, and have a central watchdog task
-		// aggregate the watchdog flags from both other tasks.
+		const uint32_t scratch = watchdog_hw->scratch[0];
+		if (watchdog_caused_reboot() && (scratch & ~0xFFu) == reset_magic)
+			reset_heartbeat_ = scratch & 0xFFu;
+		watchdog_hw->scratch[0] = 0;
+
+		// Watchdog priority is higher than background tasks, but lower than
+		// the latency critical ones, see task_priorities.h
+		// Dedicated watchdog tasks on each core beat their own heartbeat,
+		// and a central task checks every heartbeat registered.
 		// If one core locks up, the central task will detect it and not pet the
 		// watchdog, or it will itself be hung, leading to a system reset.
 		for (size_t i = 0; i < cpu_cores; ++i)
 		{
-			xTaskCreateAffinitySet(
+			const int id = add(watchdog_task_names[i], cpu_deadline_us);
+			watchdog_cpu_tasks[i].create(
 				watchdog_cpu_task,
 				watchdog_task_names[i],
-				configMINIMAL_STACK_SIZE,
-				&watchdog_cpu_status[i],
-				tskIDLE_PRIORITY+2,
-				1 << i,
-				nullptr);
+				reinterpret_cast<void*>(id),
+				watchdog_task_priority,
+				1 << i);
 		}
-		xTaskCreateAffinitySet(
-			watchdog_task,
+		watchdog_core_task.create(
+			supervisor_task,
 			"sctu_watchdog_core",
-			configMINIMAL_STACK_SIZE,
-			nullptr,
-			tskIDLE_PRIORITY+2,
-			(1 << 0) | (1 << 1),
-			nullptr);
+			this,
+			watchdog_task_priority,
+			(1 << 0) | (1 << 1));
 	}
+
+	watchdog_supervisor supervisor;
 }